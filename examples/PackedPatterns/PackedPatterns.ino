@@ -0,0 +1,40 @@
+#include <RGBLed.h>
+#include <PatternLibrary.h>
+
+RGBLed led(11, 10, 9, RGBLed::COMMON_CATHODE);
+
+// 12 bytes per pattern, stored in flash
+const PackedPattern patterns[] PROGMEM = {
+	RGBLed::packPattern(PatternLibrary::idle()),
+	RGBLed::packPattern(PatternLibrary::processing()),
+	RGBLed::packPattern(PatternLibrary::error()),
+	RGBLed::packPattern(PatternLibrary::charging())
+};
+
+const int patternCount = sizeof(patterns) / sizeof(patterns[0]);
+int current = 0;
+unsigned long lastSwitch = 0;
+
+void setup() {
+	Serial.begin(9600);
+
+	// Size report
+	Serial.print("sizeof(Pattern): ");
+	Serial.println(sizeof(Pattern));
+	Serial.print("sizeof(PackedPattern): ");
+	Serial.println(sizeof(PackedPattern));
+
+	led.callPattern_P(&patterns[current]);
+}
+
+void loop() {
+
+	// Switch pattern every 5s
+	if (millis() - lastSwitch >= 5000) {
+		lastSwitch = millis();
+		current = (current + 1) % patternCount;
+		led.callPattern_P(&patterns[current]);
+	}
+
+	led.updatePattern(millis());
+}
@@ -0,0 +1,294 @@
+// Benchmark.cpp
+// Host micro-benchmarks for RGBLed, built against the extras/host stand-in
+//
+// Build and run from the library root: make -C extras benchmark
+//
+// Each pattern runs for SIMULATED_MS of virtual time with one updatePattern()
+// per millisecond. Wall time is measured on the host, so numbers are only
+// comparable between runs on the same machine. The first table times the
+// interpolation of one fade tick in TSC cycles on x86: the float code the
+// executors used to run, Q16 with a divide per tick, and Q16 with the
+// reciprocal the samplers take once per ramp. The host has an FPU and a
+// hardware divider, an AVR emulates both, so the gaps there are far wider. Build with
+// CXXFLAGS="-O2 -DRGBLED_STATS" to also count how many ticks ran the
+// executor. The last table compares an RGBLedGroup with the same number of
+// RGBLed objects on every pattern type, time per tick and RAM per led
+// (sizes of this host, not of the board). Both run the same engine, the
+// group gains by gating all its leds on the earliest deadline.
+
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+#include "Arduino.h"
+#include "RGBLed.h"
+#include "RGBLedGroup.h"
+#include "PatternLibrary.h"
+
+static const unsigned long SIMULATED_MS = 60000;
+
+static const uint8_t PROGRAM[] = {
+	OP_RAMP, 255, 0, 0, PATTERN_TIME(500),
+	OP_WAIT, PATTERN_TIME(250),
+	OP_RAMP, 0, 0, 255, PATTERN_TIME(500),
+	OP_LOOP, 3, 0,
+	OP_JUMP, 0};
+
+struct Case
+{
+	const char *name;
+	Pattern pattern;
+};
+
+static Case CASES[] = {
+	{"STATIC", RGBLed::createStaticPattern(255, 0, 0, 1000, true)},
+	{"FADE", RGBLed::createFadePattern(0, 0, 0, 255, 128, 0, 2000, 2000, true)},
+	{"BLINK", RGBLed::createBlinkPattern(0, 255, 0, 100, 100)},
+	{"CROSSFADE", RGBLed::createCrossfadePattern(255, 0, 0, 0, 0, 255, 1500, 500)},
+	{"SEQUENCE", PatternLibrary::rainbow()},
+	{"PROGRAM", RGBLed::createProgramPattern(PROGRAM, sizeof(PROGRAM))},
+	{"HUE_CYCLE", RGBLed::createHueCyclePattern(6000)},
+};
+
+// 205 output levels in 2000 ms, polled far more often than that
+static Case FADES[] = {
+	{"linear", RGBLed::createFadePattern(0, 0, 50, 0, 0, 255, 2000, 0, true)},
+	{"sine", RGBLed::createFadePattern(0, 0, 50, 0, 0, 255, 2000, 0, true, EASE_SINE)},
+};
+static const unsigned long POLL_US[] = {1000, 100, 10};
+
+static double elapsedNs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Cycles where the host has a cycle counter, ns elsewhere
+static unsigned long long clockNow()
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+#endif
+}
+
+static const unsigned long FADE_MS = 2000;
+static const uint8_t FADE_FROM[3] = {255, 40, 0}, FADE_TO[3] = {0, 90, 250};
+static volatile uint8_t sink;
+
+// One fade tick as the executors computed it before the fixed-point rewrite
+static void floatTick(unsigned long elapsed, uint8_t *rgb)
+{
+	float progress = (float)elapsed / (float)FADE_MS;
+	for (uint8_t c = 0; c < 3; c++)
+		rgb[c] = FADE_FROM[c] + (FADE_TO[c] - FADE_FROM[c]) * progress;
+}
+
+// The same tick in Q16, dividing by the duration every time
+static void divideTick(unsigned long elapsed, uint8_t *rgb)
+{
+	uint16_t progress = RGBLed::progress16(elapsed, FADE_MS);
+	for (uint8_t c = 0; c < 3; c++)
+		rgb[c] = RGBLed::lerp8(FADE_FROM[c], FADE_TO[c], progress);
+}
+
+// The library's path: the reciprocal is taken once, when the ramp starts
+static const RGBLed::RampRate FADE_RATE = RGBLed::rampRate(FADE_MS);
+
+static void fixedTick(unsigned long elapsed, uint8_t *rgb)
+{
+	uint16_t progress = RGBLed::progress16(elapsed, FADE_RATE);
+	for (uint8_t c = 0; c < 3; c++)
+		rgb[c] = RGBLed::lerp8(FADE_FROM[c], FADE_TO[c], progress);
+}
+
+// Clock units per tick over every ms of the fade, best of a few rounds
+static double timeTicks(void (*tick)(unsigned long, uint8_t *))
+{
+	double best = 0;
+	uint8_t rgb[3];
+
+	for (int round = 0; round < 20; round++)
+	{
+		unsigned long long start = clockNow();
+		for (unsigned long elapsed = 0; elapsed < FADE_MS; elapsed++)
+		{
+			tick(elapsed, rgb);
+			sink = rgb[0] ^ rgb[1] ^ rgb[2];
+		}
+		double per_tick = (double)(clockNow() - start) / FADE_MS;
+		if (round == 0 || per_tick < best)
+			best = per_tick;
+	}
+	return best;
+}
+
+static void interpolation()
+{
+	// Float agrees within one level, both Q16 paths exactly
+	int worst = 0;
+	unsigned long mismatches = 0;
+	for (unsigned long elapsed = 0; elapsed < FADE_MS; elapsed++)
+	{
+		uint8_t a[3], b[3], d[3];
+		floatTick(elapsed, a);
+		fixedTick(elapsed, b);
+		divideTick(elapsed, d);
+		for (uint8_t c = 0; c < 3; c++)
+		{
+			int diff = a[c] > b[c] ? a[c] - b[c] : b[c] - a[c];
+			if (diff > worst)
+				worst = diff;
+			if (b[c] != d[c])
+				mismatches++;
+		}
+	}
+
+#ifdef HAVE_RDTSC
+	const char *unit = "cycles/tick";
+#else
+	const char *unit = "ns/tick";
+#endif
+	printf("Fade interpolation, 3 channels, %lu ms fade (float differs by %d level, Q16 paths in %lu channels)\n",
+		   FADE_MS, worst, mismatches);
+	printf("%-14s %12s\n", "path", unit);
+	printf("%-14s %12.1f\n", "float", timeTicks(floatTick));
+	printf("%-14s %12.1f\n", "Q16 divide", timeTicks(divideTick));
+	printf("%-14s %12.1f\n\n", "Q16 reciprocal", timeTicks(fixedTick));
+}
+
+// Run leds through the same pattern, returns wall time in ns
+static double run(std::vector<RGBLed *> &leds, Pattern *pattern)
+{
+	host::setMillis(0);
+	host::resetPwm();
+	for (size_t i = 0; i < leds.size(); i++)
+		leds[i]->callPattern(pattern);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned long now = 0; now < SIMULATED_MS; now++)
+	{
+		for (size_t i = 0; i < leds.size(); i++)
+			leds[i]->updatePattern(now);
+	}
+	return elapsedNs(start);
+}
+
+// Poll one led every poll_us of virtual time, returns wall time in ns
+static double runPolled(RGBLed &led, Pattern *pattern, unsigned long poll_us)
+{
+	host::setMillis(0);
+	host::resetPwm();
+	led.callPattern(pattern);
+#ifdef RGBLED_STATS
+	led.resetStats();
+#endif
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned long long us = 0; us < SIMULATED_MS * 1000ULL; us += poll_us)
+		led.updatePattern((unsigned long)(us / 1000));
+	return elapsedNs(start);
+}
+
+// The same pattern on every led of a group, returns wall time in ns
+static double runGroup(RGBLedGroup &group, Pattern *pattern)
+{
+	host::setMillis(0);
+	host::resetPwm();
+	for (uint8_t i = 0; i < group.size(); i++)
+		group.callPattern(i, pattern);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned long now = 0; now < SIMULATED_MS; now++)
+		group.updatePatterns(now);
+	return elapsedNs(start);
+}
+
+static void createLeds(std::vector<RGBLed *> &leds, size_t count)
+{
+	while (leds.size() < count)
+	{
+		int pin = (int)leds.size() * 3;
+		leds.push_back(new RGBLed(pin, pin + 1, pin + 2, RGBLed::COMMON_CATHODE));
+	}
+}
+
+int main()
+{
+	std::vector<RGBLed *> leds;
+	createLeds(leds, 1);
+
+	interpolation();
+
+	printf("Per pattern type, 1 led, %lu ms simulated\n", SIMULATED_MS);
+	printf("%-10s %12s %12s\n", "type", "ns/tick", "writes/s");
+	for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++)
+	{
+		double ns = run(leds, &CASES[i].pattern);
+		printf("%-10s %12.1f %12.1f\n", CASES[i].name, ns / SIMULATED_MS,
+			   host::pwmWrites() * 1000.0 / SIMULATED_MS);
+	}
+
+	static const size_t COUNTS[] = {1, 10, 100, 1000};
+	printf("\nCROSSFADE on N leds, one tick updates every led\n");
+	printf("%-10s %12s %12s %12s\n", "leds", "ns/tick", "ns/led", "writes/s");
+	for (size_t i = 0; i < sizeof(COUNTS) / sizeof(COUNTS[0]); i++)
+	{
+		createLeds(leds, COUNTS[i]);
+		double ns = run(leds, &CASES[3].pattern);
+		printf("%-10lu %12.1f %12.1f %12.1f\n", (unsigned long)COUNTS[i], ns / SIMULATED_MS,
+			   ns / SIMULATED_MS / COUNTS[i], host::pwmWrites() * 1000.0 / SIMULATED_MS);
+	}
+
+	// Ticks before the next output level only compare the time
+	printf("\nFADE blue 50 to 255 in 2000 ms, polled every poll us\n");
+	printf("%-10s %10s %12s %12s", "curve", "poll (us)", "ns/tick", "writes/s");
+#ifdef RGBLED_STATS
+	printf(" %12s", "executed/s");
+#endif
+	printf("\n");
+	for (size_t i = 0; i < sizeof(FADES) / sizeof(FADES[0]); i++)
+	{
+		for (size_t j = 0; j < sizeof(POLL_US) / sizeof(POLL_US[0]); j++)
+		{
+			double ticks = SIMULATED_MS * 1000.0 / POLL_US[j];
+			double ns = runPolled(*leds[0], &FADES[i].pattern, POLL_US[j]);
+			printf("%-10s %10lu %12.1f %12.1f", FADES[i].name, POLL_US[j], ns / ticks,
+				   host::pwmWrites() * 1000.0 / SIMULATED_MS);
+#ifdef RGBLED_STATS
+			printf(" %12.1f", leds[0]->stats().program.calls * 1000.0 / SIMULATED_MS);
+#endif
+			printf("\n");
+		}
+	}
+
+	// One group against as many RGBLed objects, same pins and patterns
+	printf("\nRGBLedGroup against N RGBLed objects, RAM per led: group %.1f bytes, RGBLed %lu bytes (this host)\n",
+		   (double)sizeof(RGBLedGroup) / RGBLED_GROUP_MAX, (unsigned long)sizeof(RGBLed));
+	printf("%-10s %6s %12s %12s %12s %12s\n", "type", "leds", "group ns", "RGBLed ns", "group/led", "RGBLed/led");
+	static const uint8_t GROUP_COUNTS[] = {1, 8, RGBLED_GROUP_MAX};
+	for (size_t c = 0; c < sizeof(CASES) / sizeof(CASES[0]); c++)
+	{
+		Case *type = &CASES[c];
+		for (size_t i = 0; i < sizeof(GROUP_COUNTS) / sizeof(GROUP_COUNTS[0]); i++)
+		{
+			uint8_t count = GROUP_COUNTS[i];
+			RGBLedGroup group(RGBLed::COMMON_CATHODE);
+			for (uint8_t k = 0; k < count; k++)
+				group.add(k * 3, k * 3 + 1, k * 3 + 2);
+			std::vector<RGBLed *> single(leds.begin(), leds.begin() + count);
+
+			double group_ns = runGroup(group, &type->pattern) / SIMULATED_MS;
+			double led_ns = run(single, &type->pattern) / SIMULATED_MS;
+			printf("%-10s %6u %12.1f %12.1f %12.1f %12.1f\n", type->name, count, group_ns, led_ns, group_ns / count,
+				   led_ns / count);
+		}
+	}
+
+	for (size_t i = 0; i < leds.size(); i++)
+		delete leds[i];
+	return 0;
+}
@@ -0,0 +1,125 @@
+#include "Arduino.h"
+
+HostSerial Serial;
+
+static unsigned long host_micros = 0;
+static int host_pwm[host::MAX_PINS];
+static unsigned long host_pwm_writes = 0;
+
+unsigned long millis()
+{
+    return host_micros / 1000;
+}
+
+unsigned long micros()
+{
+    return host_micros;
+}
+
+void delay(unsigned long ms)
+{
+    host_micros += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    host_micros += us;
+}
+
+void yield()
+{
+}
+
+void pinMode(int pin, int mode)
+{
+    (void)pin;
+    (void)mode;
+}
+
+void analogWrite(int pin, int value)
+{
+    if (pin >= 0 && pin < host::MAX_PINS)
+        host_pwm[pin] = value;
+    host_pwm_writes++;
+}
+
+size_t Print::write(uint8_t c)
+{
+    return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+        n += write(*buffer++);
+    return n;
+}
+
+size_t Print::print(const char *s)
+{
+    return write((const uint8_t *)s, strlen(s));
+}
+
+size_t Print::print(long value)
+{
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%ld", value);
+    return print(buffer);
+}
+
+size_t Print::print(unsigned long value)
+{
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%lu", value);
+    return print(buffer);
+}
+
+size_t Print::println(const char *s)
+{
+    return print(s) + println();
+}
+
+size_t Print::println(long value)
+{
+    return print(value) + println();
+}
+
+size_t Print::println(unsigned long value)
+{
+    return print(value) + println();
+}
+
+size_t Print::println()
+{
+    return print("\r\n");
+}
+
+namespace host
+{
+    void setMillis(unsigned long ms)
+    {
+        host_micros = ms * 1000;
+    }
+
+    void advanceMillis(unsigned long ms)
+    {
+        host_micros += ms * 1000;
+    }
+
+    int pwm(int pin)
+    {
+        return pin >= 0 && pin < MAX_PINS ? host_pwm[pin] : 0;
+    }
+
+    unsigned long pwmWrites()
+    {
+        return host_pwm_writes;
+    }
+
+    void resetPwm()
+    {
+        memset(host_pwm, 0, sizeof(host_pwm));
+        host_pwm_writes = 0;
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * Arduino.h
+ * Host stand-in for the Arduino core, to build the library on a PC
+ *
+ * Provides a virtual clock (millis/micros/delay never block) and records
+ * every analogWrite(). Not used by the Arduino IDE: extras/ is not compiled.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define memcpy_P memcpy
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Virtual clock
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// Pins, analogWrite() is recorded
+void pinMode(int pin, int mode);
+void analogWrite(int pin, int value);
+
+// No interrupts on the host
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// Minimal Print / Serial writing to stdout
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c);
+	size_t write(const uint8_t *buffer, size_t size);
+
+	size_t print(const char *s);
+	size_t print(long value);
+	size_t print(unsigned long value);
+	size_t print(int value) { return print((long)value); }
+	size_t print(unsigned int value) { return print((unsigned long)value); }
+	size_t println(const char *s);
+	size_t println(long value);
+	size_t println(unsigned long value);
+	size_t println(int value) { return println((long)value); }
+	size_t println(unsigned int value) { return println((unsigned long)value); }
+	size_t println();
+};
+
+class HostSerial : public Print
+{
+public:
+	void begin(unsigned long baud) { (void)baud; }
+};
+
+extern HostSerial Serial;
+
+// Readable byte stream, as in the Arduino core
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+};
+
+// In-memory stream: bytes written are read back in order
+class MemoryStream : public Stream
+{
+public:
+	MemoryStream() : _head(0), _tail(0) {}
+
+	size_t write(uint8_t c)
+	{
+		if (_tail - _head >= sizeof(_buffer))
+			return 0;
+		_buffer[_tail++ % sizeof(_buffer)] = c;
+		return 1;
+	}
+	using Print::write;
+
+	int available() { return (int)(_tail - _head); }
+	int read() { return _head == _tail ? -1 : _buffer[_head++ % sizeof(_buffer)]; }
+	int peek() { return _head == _tail ? -1 : _buffer[_head % sizeof(_buffer)]; }
+
+private:
+	uint8_t _buffer[256];
+	size_t _head;
+	size_t _tail;
+};
+
+// Host control of the stand-in
+namespace host
+{
+	static const int MAX_PINS = 4096;
+
+	void setMillis(unsigned long ms);
+	void advanceMillis(unsigned long ms);
+
+	// Last value written to a pin, and total analogWrite() calls
+	int pwm(int pin);
+	unsigned long pwmWrites();
+	void resetPwm();
+}
+
+#endif // HOST_ARDUINO_H
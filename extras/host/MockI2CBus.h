@@ -0,0 +1,50 @@
+/*
+ * MockI2CBus.h
+ * Host I2CBus: emulates the PCA9685 register file and counts traffic
+ */
+
+#ifndef MOCK_I2C_BUS_H
+#define MOCK_I2C_BUS_H
+
+#include "PCA9685Driver.h"
+
+class MockI2CBus : public I2CBus
+{
+public:
+	MockI2CBus() { reset(); }
+
+	bool write(uint8_t address, const uint8_t *data, uint8_t length)
+	{
+		(void)address;
+		_transactions++;
+		// Start, address byte and stop, then the payload
+		_bytes += 1 + length;
+
+		if (length == 0)
+			return true;
+
+		// Auto-increment from the register address in the first byte
+		uint8_t reg = data[0];
+		for (uint8_t i = 1; i < length; i++)
+			registers[reg++] = data[i];
+		return true;
+	}
+
+	void reset()
+	{
+		_transactions = 0;
+		_bytes = 0;
+		memset(registers, 0, sizeof(registers));
+	}
+
+	unsigned long transactions() { return _transactions; }
+	unsigned long bytes() { return _bytes; }
+
+	uint8_t registers[256];
+
+private:
+	unsigned long _transactions;
+	unsigned long _bytes;
+};
+
+#endif // MOCK_I2C_BUS_H
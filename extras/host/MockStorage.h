@@ -0,0 +1,77 @@
+/*
+ * MockStorage.h
+ * Host PatternStorage: erased (0xFF) bytes in RAM, counts traffic
+ *
+ * tearAfter(n) simulates a reset during a save: n more bytes are written,
+ * the write that crosses the limit stops there and every later write and
+ * commit fails.
+ */
+
+#ifndef MOCK_STORAGE_H
+#define MOCK_STORAGE_H
+
+#include "PatternStore.h"
+
+class MockStorage : public PatternStorage
+{
+public:
+	static const unsigned long NO_TEAR = 0xFFFFFFFFUL;
+
+	MockStorage() { reset(); }
+
+	bool read(uint16_t address, uint8_t *data, uint8_t length)
+	{
+		if (address + length > sizeof(bytes))
+			return false;
+		_reads++;
+		memcpy(data, bytes + address, length);
+		return true;
+	}
+
+	bool write(uint16_t address, const uint8_t *data, uint8_t length)
+	{
+		if (address + length > sizeof(bytes))
+			return false;
+
+		uint8_t written = length;
+		if (_budget < length)
+			written = _budget;
+		_budget = _budget == NO_TEAR ? NO_TEAR : _budget - written;
+		_bytes_written += written;
+		memcpy(bytes + address, data, written);
+		return written == length;
+	}
+
+	bool commit()
+	{
+		if (_budget == 0)
+			return false;
+		_commits++;
+		return true;
+	}
+
+	void reset()
+	{
+		_reads = 0;
+		_bytes_written = 0;
+		_commits = 0;
+		_budget = NO_TEAR;
+		memset(bytes, 0xFF, sizeof(bytes));
+	}
+
+	void tearAfter(unsigned long bytes_left) { _budget = bytes_left; }
+
+	unsigned long reads() { return _reads; }
+	unsigned long bytesWritten() { return _bytes_written; }
+	unsigned long commits() { return _commits; }
+
+	uint8_t bytes[256];
+
+private:
+	unsigned long _reads;
+	unsigned long _bytes_written;
+	unsigned long _commits;
+	unsigned long _budget; // Bytes until the simulated reset
+};
+
+#endif // MOCK_STORAGE_H
@@ -0,0 +1,76 @@
+/*
+ * SimulatedTickSource.h
+ * Host TickSource: a virtual clock, advance() fires the ticks that fall due
+ */
+
+#ifndef SIMULATED_TICK_SOURCE_H
+#define SIMULATED_TICK_SOURCE_H
+
+#include "TickSource.h"
+
+class SimulatedTickSource : public TickSource
+{
+public:
+	SimulatedTickSource() : _now(0), _next_tick(0), _period(1), _remainder(0), _error(0), _frequency(1), _ticks(0), _running(false) {}
+
+	// Up to one tick per ms. The period is 1000 / frequency ms, the remainder
+	// is carried from tick to tick: 300 Hz ticks every 3 or 4 ms, 300 times a
+	// second.
+	bool begin(uint16_t frequency)
+	{
+		if (frequency == 0 || frequency > 1000)
+			return false;
+
+		_frequency = frequency;
+		_period = 1000 / frequency;
+		_remainder = 1000 % frequency;
+		_error = 0;
+		_next_tick = _now + nextPeriod();
+		_running = true;
+		return true;
+	}
+
+	void end()
+	{
+		_running = false;
+	}
+
+	// Advance the virtual clock, ticking at every period boundary
+	void advance(unsigned long ms)
+	{
+		unsigned long target = _now + ms;
+
+		while (_running && (long)(target - _next_tick) >= 0)
+		{
+			_now = _next_tick;
+			_next_tick += nextPeriod();
+			_ticks++;
+			tick(_now);
+		}
+		_now = target;
+	}
+
+	unsigned long now() { return _now; }
+	unsigned long ticks() { return _ticks; }
+
+private:
+	unsigned long _now;
+	unsigned long _next_tick;
+	unsigned long _period;
+	uint16_t _remainder;
+	uint16_t _error; // Remainder carried, in 1/frequency ms
+	uint16_t _frequency;
+	unsigned long _ticks;
+	bool _running;
+
+	unsigned long nextPeriod()
+	{
+		_error += _remainder;
+		if (_error < _frequency)
+			return _period;
+		_error -= _frequency;
+		return _period + 1;
+	}
+};
+
+#endif // SIMULATED_TICK_SOURCE_H
@@ -0,0 +1,35 @@
+/*
+ * Check.h
+ * Checks shared by the host tests: a failed CHECK() prints its line and
+ * counts, report() prints the result and returns the exit status
+ */
+
+#ifndef RGBLED_CHECK_H
+#define RGBLED_CHECK_H
+
+#include <cstdio>
+
+static unsigned long failures = 0;
+
+#define CHECK(condition)                                                   \
+	do                                                                     \
+	{                                                                      \
+		if (!(condition))                                                  \
+		{                                                                  \
+			failures++;                                                    \
+			printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+		}                                                                  \
+	} while (0)
+
+static int report()
+{
+	if (failures > 0)
+	{
+		printf("FAIL: %lu checks\n", failures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
+
+#endif // RGBLED_CHECK_H
@@ -0,0 +1,121 @@
+// CommandQueueStress.cpp
+// Host stress test of the lock-free command queue: one std::thread posts
+// patterns while another runs updatePattern(), built against extras/host
+//
+// Build and run from the library root: make -C extras test
+// (the Makefile builds it with -DRGBLED_COMMAND_SLOTS=4, post*() needs a queue)
+//
+// Pattern i shows (i, i * 7, 255 - i) modulo 256. The producer posts a local
+// and scribbles over it at once, so a queue that kept the pointer instead of
+// a copy shows colors off that line. The consumer checks every color it
+// writes and that the patterns arrive in order. Exit status 0 on success.
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include "Arduino.h"
+#include "RGBLed.h"
+
+#if RGBLED_COMMAND_SLOTS == 0
+#error "Build with -DRGBLED_COMMAND_SLOTS=4, library included"
+#endif
+
+static const unsigned long PATTERNS = 100000;
+static const int RED_PIN = 1, GREEN_PIN = 2, BLUE_PIN = 3;
+
+static std::atomic<bool> done(false);
+static unsigned long failures = 0;
+
+static Pattern numbered(unsigned long i)
+{
+	uint8_t n = i & 0xFF;
+	return RGBLed::createStaticPattern(n, (uint8_t)(n * 7), 255 - n, 3600000UL);
+}
+
+static void produce(RGBLed *led)
+{
+	unsigned long full = 0;
+
+	for (unsigned long i = 1; i <= PATTERNS; i++)
+	{
+		Pattern pattern = numbered(i);
+		while (!led->postPattern(&pattern))
+		{
+			full++;
+			std::this_thread::yield();
+		}
+		// The queue holds a copy, this must not show up
+		pattern.static_pattern.g = ~pattern.static_pattern.g;
+
+		// A brightness request in between, same level
+		if (i % 16 == 0)
+		{
+			while (!led->postBrightness(100))
+				std::this_thread::yield();
+		}
+	}
+	printf("producer: %lu patterns, queue full %lu times\n", PATTERNS, full);
+	done = true;
+}
+
+// Check the color on the pins, returns its pattern number (low byte)
+static uint8_t check(uint8_t last)
+{
+	uint8_t r = host::pwm(RED_PIN), g = host::pwm(GREEN_PIN), b = host::pwm(BLUE_PIN);
+	uint8_t step = r - last;
+
+	if (g != (uint8_t)(r * 7) || b != 255 - r)
+	{
+		if (failures++ < 10)
+			printf("torn pattern: %u %u %u\n", r, g, b);
+	}
+	else if (step > RGBLED_COMMAND_SLOTS)
+	{
+		// The queue holds RGBLED_COMMAND_SLOTS requests, no update can skip more
+		if (failures++ < 10)
+			printf("out of order: %u after %u\n", r, last);
+	}
+	return r;
+}
+
+int main()
+{
+	RGBLed led(RED_PIN, GREEN_PIN, BLUE_PIN, RGBLed::COMMON_CATHODE);
+	led.gamma(false);
+	led.callPattern(numbered(0));
+	led.updatePattern(millis());
+
+	std::thread producer(produce, &led);
+
+	unsigned long updates = 0;
+	uint8_t last = 0;
+	while (!done)
+	{
+		led.updatePattern(millis());
+		last = check(last);
+		delay(1);
+		updates++;
+
+		// Let the producer run on a single core too
+		std::this_thread::yield();
+	}
+	producer.join();
+
+	// Drain what is left
+	led.updatePattern(millis());
+	last = check(last);
+
+	printf("consumer: %lu updates, last pattern %u\n", updates, last);
+	if (last != (PATTERNS & 0xFF))
+	{
+		printf("FAIL: the last pattern was not applied\n");
+		return 1;
+	}
+	if (failures > 0)
+	{
+		printf("FAIL: %lu bad colors\n", failures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
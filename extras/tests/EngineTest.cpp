@@ -0,0 +1,305 @@
+// EngineTest.cpp
+// Host test of the pattern engine: what a led shows over time is checked
+// against RGBLed::evaluate(), the stateless reference on the same bytecode
+//
+// Build and run from the library root: make -C extras test
+//
+// Covers every pattern type ticked once per millisecond, a led updated only
+// at the deadlines updatePattern() returns, priority layers and transients
+// resuming where they left off, and epochs ahead, behind and across the
+// millis() wrap. Exit status 0 on success.
+
+#include <cstdio>
+#include "Arduino.h"
+#include "Check.h"
+#include "RGBLed.h"
+#include "PatternLibrary.h"
+
+static const int PINS[2][3] = {{1, 2, 3}, {4, 5, 6}};
+
+static const uint8_t PROGRAM[] = {
+	OP_SET, 0, 0, 40,
+	OP_EASE, EASE_IN_OUT,
+	OP_RAMP, 255, 0, 0, PATTERN_TIME(300),
+	OP_WAIT, PATTERN_TIME(100),
+	OP_RAMP, 0, 0, 255, PATTERN_TIME(300),
+	OP_LOOP, 2, 6,
+	OP_HUE, 0, 128, 255, 200, PATTERN_TIME(500),
+	OP_JUMP, 6};
+
+struct Case
+{
+	const char *name;
+	Pattern pattern;
+	bool completes;
+};
+
+static const Case CASES[] = {
+	{"static", RGBLed::createStaticPattern(255, 0, 0, 700, false), true},
+	{"fade", RGBLed::createFadePattern(0, 0, 0, 255, 128, 0, 900, 300, true), false},
+	{"sine fade", RGBLed::createFadePattern(0, 0, 10, 0, 200, 250, 700, 0, true, EASE_SINE), false},
+	{"blink", RGBLed::createBlinkPattern(0, 255, 0, 37, 13), false},
+	{"blink x3", RGBLed::createBlinkPattern(0, 255, 0, 100, 50, 3, false), true},
+	{"crossfade", RGBLed::createCrossfadePattern(255, 0, 0, 0, 0, 255, 1100, 400), false},
+	{"sequence", PatternLibrary::rainbow(), false},
+	{"program", RGBLed::createProgramPattern(PROGRAM, sizeof(PROGRAM)), false},
+	{"hue cycle", RGBLed::createHueCyclePattern(6000), false},
+};
+
+static const unsigned long RUN_MS = 12000;
+
+static bool shows(uint8_t led, const uint8_t rgb[3])
+{
+	return host::pwm(PINS[led][0]) == rgb[0] && host::pwm(PINS[led][1]) == rgb[1] &&
+		   host::pwm(PINS[led][2]) == rgb[2];
+}
+
+static bool dark(uint8_t led)
+{
+	static const uint8_t black[3] = {0, 0, 0};
+	return shows(led, black);
+}
+
+static bool sameOutput()
+{
+	for (uint8_t c = 0; c < 3; c++)
+	{
+		if (host::pwm(PINS[0][c]) != host::pwm(PINS[1][c]))
+			return false;
+	}
+	return true;
+}
+
+// One update per ms shows evaluate() at every ms, and stops when it does
+static void evaluateMatchesUpdate(const Case &test)
+{
+	host::setMillis(0);
+	host::resetPwm();
+	RGBLed led(PINS[0][0], PINS[0][1], PINS[0][2], RGBLed::COMMON_CATHODE);
+	led.gamma(false);
+	led.callPattern(test.pattern);
+
+	unsigned long mismatches = 0;
+	bool completed = false;
+	for (unsigned long t = 0; t < RUN_MS && !completed; t++)
+	{
+		host::setMillis(t);
+		led.updatePattern(t);
+		PatternSample sample = RGBLed::evaluate(test.pattern, t);
+
+		if (!sample.active)
+		{
+			completed = true;
+			CHECK(!led.isPatternActive());
+			CHECK(dark(0));
+		}
+		else if (!shows(0, sample.rgb))
+		{
+			if (mismatches++ == 0)
+				printf("%s: differs from evaluate() at %lu ms\n", test.name, t);
+		}
+	}
+	CHECK(mismatches == 0);
+	if (completed != test.completes)
+		printf("%s: %s\n", test.name, completed ? "completed" : "did not complete");
+	CHECK(completed == test.completes);
+
+	// The batch walks once and gives the same samples
+	static const unsigned long times[] = {0, 1, 250, 251, 999, 5000, 11999};
+	PatternSample samples[sizeof(times) / sizeof(times[0])];
+	RGBLed::evaluate(test.pattern, times, samples, sizeof(times) / sizeof(times[0]));
+	for (uint8_t i = 0; i < sizeof(times) / sizeof(times[0]); i++)
+	{
+		PatternSample single = RGBLed::evaluate(test.pattern, times[i]);
+		CHECK(samples[i].rgb[0] == single.rgb[0] && samples[i].rgb[1] == single.rgb[1] &&
+			  samples[i].rgb[2] == single.rgb[2]);
+		CHECK(samples[i].active == single.active && samples[i].next == single.next);
+	}
+}
+
+// A led updated only when its deadline is due shows, at every ms, what a
+// led updated every ms shows: no level change is late or missed
+static void deadlineMatchesPerMs(const Case &test)
+{
+	host::setMillis(0);
+	host::resetPwm();
+	RGBLed polled(PINS[0][0], PINS[0][1], PINS[0][2], RGBLed::COMMON_CATHODE);
+	RGBLed woken(PINS[1][0], PINS[1][1], PINS[1][2], RGBLed::COMMON_CATHODE);
+	polled.callPattern(test.pattern);
+	woken.callPattern(test.pattern);
+
+	unsigned long mismatches = 0, wakes = 0, due = 0;
+	for (unsigned long t = 0; t < RUN_MS; t++)
+	{
+		host::setMillis(t);
+		polled.updatePattern(t);
+		if (t == due)
+		{
+			unsigned long next = woken.updatePattern(t);
+			CHECK(next > 0);
+			due = next == RGBLed::NO_DEADLINE ? RUN_MS : t + next;
+			wakes++;
+		}
+
+		if (!sameOutput() && mismatches++ == 0)
+			printf("%s: deadline update differs at %lu ms\n", test.name, t);
+	}
+	CHECK(mismatches == 0);
+	CHECK(wakes < RUN_MS);
+}
+
+// A pushed pattern runs on top, the one below resumes at the position it
+// was suspended at, after the pushed one completes or is popped
+static void layers()
+{
+	host::setMillis(0);
+	host::resetPwm();
+	RGBLed led(PINS[0][0], PINS[0][1], PINS[0][2], RGBLed::COMMON_CATHODE);
+	led.gamma(false);
+
+	const Pattern &base = CASES[5].pattern; // Crossfade, repeats
+	Pattern alert = RGBLed::createBlinkPattern(255, 255, 255, 40, 60, 4, false);
+	Pattern hold = RGBLed::createStaticPattern(9, 9, 9, 100, true);
+	const unsigned long ALERT = 1000, ALERT_MS = 400, HOLD = 2200, HOLD_MS = 300;
+
+	led.callPattern(base);
+	unsigned long mismatches = 0;
+	for (unsigned long t = 0; t < 5000; t++)
+	{
+		host::setMillis(t);
+		if (t == ALERT)
+			CHECK(led.pushPattern(alert, 1));
+		if (t == HOLD)
+			CHECK(led.pushPattern(hold, 1));
+		if (t == HOLD + HOLD_MS)
+			led.popPattern();
+		led.updatePattern(t);
+
+		PatternSample expected;
+		if (t < ALERT)
+			expected = RGBLed::evaluate(base, t);
+		else if (t < ALERT + ALERT_MS)
+			expected = RGBLed::evaluate(alert, t - ALERT);
+		else if (t < HOLD)
+			expected = RGBLed::evaluate(base, t - ALERT_MS);
+		else if (t < HOLD + HOLD_MS)
+			expected = RGBLed::evaluate(hold, t - HOLD);
+		else
+			expected = RGBLed::evaluate(base, t - ALERT_MS - HOLD_MS);
+
+		if (!shows(0, expected.rgb) && mismatches++ == 0)
+			printf("layers: differs at %lu ms\n", t);
+	}
+	CHECK(mismatches == 0);
+	CHECK(led.isPatternActive());
+}
+
+// A transient keeps its last color when nothing runs below it, and gives
+// the led back to the pattern it suspended otherwise
+static void transients()
+{
+	host::setMillis(0);
+	host::resetPwm();
+	RGBLed led(PINS[0][0], PINS[0][1], PINS[0][2], RGBLed::COMMON_CATHODE);
+	led.gamma(false);
+
+	led.fadeInAsync(0, 0, 200, 500);
+	for (unsigned long t = 0; t <= 600; t++)
+	{
+		host::setMillis(t);
+		led.updatePattern(t);
+	}
+	static const uint8_t blue[3] = {0, 0, 200};
+	CHECK(!led.isPatternActive());
+	CHECK(shows(0, blue));
+
+	Pattern base = CASES[3].pattern; // Blink, forever
+	const unsigned long START = 1000, FLASH = 1234, FLASH_MS = 300;
+	unsigned long mismatches = 0;
+	for (unsigned long t = START; t < 3000; t++)
+	{
+		host::setMillis(t);
+		if (t == START)
+			led.callPattern(base);
+		if (t == FLASH)
+			led.flashAsync(255, 0, 255, 200, FLASH_MS - 200); // On, then off
+		led.updatePattern(t);
+
+		if (t >= FLASH && t < FLASH + FLASH_MS)
+			continue;
+		unsigned long position = t < FLASH ? t - START : t - START - FLASH_MS;
+		PatternSample expected = RGBLed::evaluate(base, position);
+		if (!shows(0, expected.rgb) && mismatches++ == 0)
+			printf("transients: differs at %lu ms\n", t);
+	}
+	CHECK(mismatches == 0);
+	CHECK(led.isPatternActive());
+}
+
+// Leds called at different times with one epoch show the same colors, dark
+// until an epoch still to come. start is where millis() begins.
+static void epoch(unsigned long start, long offset)
+{
+	host::setMillis(start);
+	host::resetPwm();
+	RGBLed led(PINS[0][0], PINS[0][1], PINS[0][2], RGBLed::COMMON_CATHODE);
+	led.gamma(false);
+
+	const Pattern &pattern = CASES[7].pattern; // Program
+	unsigned long at = start + offset;
+	led.callPattern(pattern, at);
+
+	unsigned long mismatches = 0;
+	for (unsigned long i = 0; i < 4000; i++)
+	{
+		unsigned long now = start + i;
+		host::setMillis(now);
+		led.updatePattern(now);
+
+		unsigned long position = now - at;
+		bool ahead = offset > 0 && i < (unsigned long)offset;
+		bool ok = ahead ? dark(0) : shows(0, RGBLed::evaluate(pattern, position).rgb);
+		if (!ok && mismatches++ == 0)
+			printf("epoch %lu%+ld: differs at %lu ms\n", start, offset, i);
+	}
+	CHECK(mismatches == 0);
+}
+
+// A now read before the call is not an epoch to come: a held color shows
+// at once and stays, it has no deadline to be woken at later
+static void staleNow()
+{
+	host::setMillis(10000);
+	host::resetPwm();
+	RGBLed led(PINS[0][0], PINS[0][1], PINS[0][2], RGBLed::COMMON_CATHODE);
+	led.gamma(false);
+
+	Pattern connected = PatternLibrary::connected();
+	PatternSample held = RGBLed::evaluate(connected, 0);
+	led.callPattern(connected);
+	led.updatePattern(9000);
+	CHECK(shows(0, held.rgb));
+	CHECK(led.updatePattern(10001) == RGBLed::NO_DEADLINE);
+	CHECK(shows(0, held.rgb));
+}
+
+int main()
+{
+	for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++)
+	{
+		evaluateMatchesUpdate(CASES[i]);
+		deadlineMatchesPerMs(CASES[i]);
+	}
+
+	layers();
+	transients();
+
+	epoch(10000, -2500);				// Behind, joins in phase
+	epoch(10000, 1500);					// Ahead, dark until then
+	epoch(0xFFFFFFFFUL - 700, 1500);	// Ahead across the millis() wrap
+	epoch(500, -(long)(2500 + 500));	// Behind across the wrap
+	epoch(10000, 0);
+	staleNow();
+
+	return report();
+}
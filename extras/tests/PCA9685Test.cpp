@@ -0,0 +1,167 @@
+// PCA9685Test.cpp
+// Host test of the PCA9685 backend: leds on one driver, flushed once per
+// tick into a MockI2CBus, which keeps the register file and counts traffic
+//
+// Build and run from the library root: make -C extras test
+// (built with -DUSE_I2C_PWM, see extras/Makefile)
+//
+// Checks that each flush leaves every channel register at the duty of its
+// led, and that it costs one transaction per run of changed channels (7 at
+// most per burst) and no traffic when nothing changed. Prints the
+// transactions and bytes per flush for 1 led and for a full driver.
+// Exit status 0 on success.
+
+#include <cstdio>
+#include "Arduino.h"
+#include "Check.h"
+#include "MockI2CBus.h"
+#include "RGBLed.h"
+
+static const uint8_t LED0_ON_L = 0x06, BURST_CHANNELS = 7;
+static const uint8_t MAX_LEDS = PCA9685Driver::CHANNELS / 3;
+static const unsigned long RUN_MS = 3000;
+
+// Duty of a channel as the driver encodes it, full on and full off included
+static uint16_t channelValue(const MockI2CBus &bus, uint8_t channel)
+{
+	const uint8_t *reg = &bus.registers[LED0_ON_L + 4 * channel];
+	uint16_t on = reg[0] | (reg[1] << 8), off = reg[2] | (reg[3] << 8);
+	if (off & 0x1000)
+		return 0;
+	if (on & 0x1000)
+		return 4095;
+	return off;
+}
+
+// Transactions and bytes a flush of the dirty channels takes: one burst per
+// run of consecutive channels, split every BURST_CHANNELS
+static void flushCost(uint16_t dirty, unsigned long &transactions, unsigned long &bytes)
+{
+	uint8_t run = 0;
+	for (uint8_t ch = 0; ch <= PCA9685Driver::CHANNELS; ch++)
+	{
+		bool changed = ch < PCA9685Driver::CHANNELS && (dirty & ((uint16_t)1 << ch));
+		if (changed && run < BURST_CHANNELS)
+		{
+			run++;
+			continue;
+		}
+		if (run > 0)
+		{
+			// Address byte, register, 4 bytes per channel
+			transactions++;
+			bytes += 2 + 4 * run;
+		}
+		run = changed ? 1 : 0;
+	}
+}
+
+static void crossfade(uint8_t count)
+{
+	host::setMillis(0);
+	MockI2CBus bus;
+	PCA9685Driver pwm(&bus);
+	CHECK(pwm.begin(1000));
+	pwm.setAutoFlush(false);
+	bus.reset(); // Counts from here, every channel off as begin() left it
+
+	RGBLed *leds[MAX_LEDS];
+	for (uint8_t i = 0; i < count; i++)
+	{
+		leds[i] = new RGBLed(&pwm, i * 3, i * 3 + 1, i * 3 + 2, RGBLed::COMMON_CATHODE);
+		leds[i]->gamma(false);
+	}
+
+	// Leds a quarter of the ramp apart, so channels change on different ticks
+	Pattern pattern = RGBLed::createCrossfadePattern(255, 40, 0, 0, 90, 250, 1000, 200, true);
+	for (uint8_t i = 0; i < count; i++)
+		leds[i]->callPattern(&pattern, 0UL - 250UL * i);
+
+	uint16_t shown[PCA9685Driver::CHANNELS] = {0};
+	unsigned long flushes = 0, busy = 0, expected_transactions = 0, expected_bytes = 0, mismatches = 0;
+	for (unsigned long t = 0; t < RUN_MS; t++)
+	{
+		host::setMillis(t);
+		for (uint8_t i = 0; i < count; i++)
+			leds[i]->updatePattern(t);
+
+		unsigned long before = bus.transactions();
+		CHECK(pwm.flush());
+		flushes++;
+		if (bus.transactions() > before)
+			busy++;
+
+		uint16_t dirty = 0;
+		for (uint8_t i = 0; i < count; i++)
+		{
+			PatternSample sample = RGBLed::evaluate(pattern, t + 250UL * i);
+			for (uint8_t c = 0; c < 3; c++)
+			{
+				uint8_t ch = i * 3 + c;
+				uint16_t value = ((uint16_t)sample.rgb[c] << 4) | (sample.rgb[c] >> 4);
+				if (channelValue(bus, ch) != value && mismatches++ == 0)
+					printf("%u leds: channel %u differs at %lu ms\n", count, ch, t);
+				if (value != shown[ch])
+					dirty |= (uint16_t)1 << ch;
+				shown[ch] = value;
+			}
+		}
+		flushCost(dirty, expected_transactions, expected_bytes);
+	}
+	CHECK(mismatches == 0);
+	CHECK(bus.transactions() == expected_transactions);
+	CHECK(bus.bytes() == expected_bytes);
+
+	// Nothing staged, nothing sent
+	unsigned long idle = bus.transactions();
+	CHECK(pwm.flush());
+	CHECK(bus.transactions() == idle);
+
+	printf("%-6u %10lu %10lu %20.2f %12.1f %16.1f\n", count, flushes, busy,
+		   (double)bus.transactions() / flushes, (double)bus.bytes() / flushes,
+		   busy > 0 ? (double)bus.bytes() / busy : 0.0);
+
+	for (uint8_t i = 0; i < count; i++)
+		delete leds[i];
+}
+
+// Auto-flush: every color change is sent at once, one burst for the 3
+// consecutive channels of a led
+static void autoFlush()
+{
+	host::setMillis(0);
+	MockI2CBus bus;
+	PCA9685Driver pwm(&bus);
+	CHECK(pwm.begin(1000));
+	CHECK(pwm.autoFlush());
+
+	RGBLed led(&pwm, 4, 5, 6, RGBLed::COMMON_CATHODE);
+	led.gamma(false);
+	bus.reset();
+
+	led.setColor(255, 128, 16);
+	CHECK(bus.transactions() == 1);
+	CHECK(bus.bytes() == 2 + 4 * 3);
+	CHECK(channelValue(bus, 4) == 4095 && channelValue(bus, 5) == ((128 << 4) | 8) && channelValue(bus, 6) == ((16 << 4) | 1));
+
+	// Green only: one channel
+	led.setColor(255, 0, 16);
+	CHECK(bus.transactions() == 2);
+	CHECK(bus.bytes() == 2 + 4 * 3 + 2 + 4);
+
+	// Unchanged: no traffic
+	led.setColor(255, 0, 16);
+	CHECK(bus.transactions() == 2);
+}
+
+int main()
+{
+	printf("CROSSFADE on a PCA9685, flushed once per 1 ms tick, %lu ms\n", RUN_MS);
+	// Busy flushes sent something, the others found nothing staged
+	printf("%-6s %10s %10s %20s %12s %16s\n", "leds", "flushes", "busy", "transactions/flush", "bytes/flush", "bytes/busy");
+	crossfade(1);
+	crossfade(MAX_LEDS);
+
+	autoFlush();
+	return report();
+}
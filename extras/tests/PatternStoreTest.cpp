@@ -0,0 +1,192 @@
+// PatternStoreTest.cpp
+// Host test of PatternStore on a MockStorage: round trips, wear, a reset
+// during a save at every byte of the write, and a save from a led
+//
+// Build and run from the library root: make -C extras test
+//
+// Exit status 0 on success.
+
+#include <cstdio>
+#include "Arduino.h"
+#include "Check.h"
+#include "RGBLed.h"
+#include "PatternStore.h"
+#include "PatternStream.h"
+#include "PatternLibrary.h"
+#include "MockStorage.h"
+
+static const uint16_t ADDRESS = 32;
+
+// The store returns pattern at brightness
+static bool holds(PatternStore &store, const Pattern &pattern, uint8_t brightness)
+{
+	Pattern loaded;
+	uint8_t loaded_brightness = 0;
+
+	if (!store.load(loaded, loaded_brightness))
+		return false;
+
+	PackedPattern a = RGBLed::packPattern(loaded), b = RGBLed::packPattern(pattern);
+	return memcmp(&a, &b, sizeof(PackedPattern)) == 0 && loaded_brightness == brightness;
+}
+
+static void roundTrip()
+{
+	MockStorage storage;
+	PatternStore store(&storage, ADDRESS);
+	Pattern pattern, blink = RGBLed::createBlinkPattern(255, 0, 0, 100, 900, 0, true);
+	Pattern fade = RGBLed::createCrossfadePattern(10, 20, 30, 200, 100, 0, 1500, 500, true, true, EASE_IN_OUT);
+	uint8_t brightness;
+
+	CHECK(!store.load(pattern, brightness));
+
+	CHECK(store.save(blink, 60));
+	CHECK(holds(store, blink, 60));
+	CHECK(storage.bytesWritten() <= PatternStore::RECORD_SIZE); // Erased bytes that match are skipped
+
+	// Same content: no write, no commit
+	unsigned long written = storage.bytesWritten(), commits = storage.commits();
+	CHECK(store.save(blink, 60));
+	CHECK(storage.commits() == commits);
+	CHECK(storage.bytesWritten() == written);
+
+	CHECK(store.save(fade, 61));
+	CHECK(holds(store, fade, 61));
+	CHECK(store.save(fade, 62));
+	CHECK(holds(store, fade, 62));
+
+	// Everything stays within STORAGE_SIZE
+	for (uint16_t i = 0; i < sizeof(storage.bytes); i++)
+	{
+		if (i < ADDRESS || i >= ADDRESS + PatternStore::STORAGE_SIZE)
+			CHECK(storage.bytes[i] == 0xFF);
+	}
+
+	// A corrupt latest copy (the first one, third save) falls back to the
+	// previous one, two corrupt copies hold nothing
+	uint8_t saved[PatternStore::STORAGE_SIZE];
+	memcpy(saved, storage.bytes + ADDRESS, sizeof(saved));
+	storage.bytes[ADDRESS + 5] ^= 0x10;
+	CHECK(holds(store, fade, 61));
+	storage.bytes[ADDRESS + PatternStore::RECORD_SIZE + 5] ^= 0x10;
+	CHECK(!store.load(pattern, brightness));
+	memcpy(storage.bytes + ADDRESS, saved, sizeof(saved));
+
+	CHECK(!store.save(PatternLibrary::rainbow(), 50));
+	CHECK(holds(store, fade, 62));
+
+	CHECK(store.clear());
+	CHECK(!store.load(pattern, brightness));
+	commits = storage.commits();
+	CHECK(store.clear());
+	CHECK(storage.commits() == commits);
+
+	CHECK(store.save(blink, 10));
+	CHECK(holds(store, blink, 10));
+}
+
+// The sequence number wraps every 256 saves
+static void manySaves()
+{
+	MockStorage storage;
+	PatternStore store(&storage, ADDRESS);
+
+	for (unsigned long i = 0; i < 600; i++)
+	{
+		Pattern pattern = RGBLed::createStaticPattern(i & 0xFF, i >> 8, 7, 1000, true);
+		CHECK(store.save(pattern, i % 101));
+		if (!holds(store, pattern, i % 101))
+		{
+			failures++;
+			printf("save %lu not loaded back\n", i);
+			return;
+		}
+	}
+}
+
+// Reset after every possible number of written bytes: the store holds the
+// previous pattern or the new one, never nothing
+static void tornWrites()
+{
+	const Pattern patterns[] = {
+		RGBLed::createBlinkPattern(255, 0, 0, 100, 900, 0, true),
+		RGBLed::createFadePattern(0, 0, 50, 0, 0, 255, 2000, 0, true, EASE_IN),
+		RGBLed::createStaticPattern(1, 2, 3, 4000, true),
+		RGBLed::createHueCyclePattern(6000, 200, 180)};
+	const uint8_t count = sizeof(patterns) / sizeof(patterns[0]);
+
+	for (uint8_t saves = 1; saves <= 3; saves++)
+	{
+		for (unsigned long tear = 0; tear <= PatternStore::STORAGE_SIZE; tear++)
+		{
+			MockStorage storage;
+			PatternStore store(&storage, ADDRESS);
+
+			// A few saves first, so the copies hold different records
+			for (uint8_t i = 0; i < saves; i++)
+				store.save(patterns[i % count], 50 + i);
+			const Pattern &previous = patterns[(saves - 1) % count];
+			const Pattern &next = patterns[saves % count];
+
+			storage.tearAfter(tear);
+			bool saved = store.save(next, 90);
+			storage.tearAfter(MockStorage::NO_TEAR);
+
+			bool old_one = holds(store, previous, 50 + saves - 1);
+			bool new_one = holds(store, next, 90);
+			if (!(old_one || new_one) || (saved && !new_one))
+			{
+				failures++;
+				printf("reset after %lu bytes of save %u: saved %d, old %d, new %d\n", tear, saves + 1, saved, old_one,
+					   new_one);
+			}
+		}
+	}
+}
+
+// A pattern received by a PatternStream is saved from the led itself, and
+// restored on another one
+static void saveLed()
+{
+	MockStorage storage;
+	PatternStore store(&storage, ADDRESS);
+	RGBLed led(1, 2, 3, RGBLed::COMMON_CATHODE);
+	PatternStream parser(led);
+	MemoryStream stream;
+
+	CHECK(led.currentPattern() == nullptr);
+	CHECK(!store.save(led));
+	CHECK(storage.bytesWritten() == 0);
+
+	Pattern fade = RGBLed::createFadePattern(0, 40, 0, 250, 40, 0, 2000, 0, true, EASE_IN_OUT);
+	CHECK(PatternStream::sendPattern(stream, fade));
+	PatternStream::sendBrightness(stream, 35);
+	CHECK(parser.poll(stream) == 2);
+	CHECK(led.brightness() == 35);
+	CHECK(store.save(led));
+	CHECK(holds(store, fade, 35));
+
+	RGBLed restored(4, 5, 6, RGBLed::COMMON_CATHODE);
+	CHECK(store.restore(restored));
+	CHECK(restored.brightness() == 35);
+	CHECK(restored.currentPattern() != nullptr);
+	PackedPattern a = RGBLed::packPattern(*restored.currentPattern()), b = RGBLed::packPattern(fade);
+	CHECK(memcmp(&a, &b, sizeof(PackedPattern)) == 0);
+
+	// Every brightness reads back as set
+	for (int brightness = 0; brightness <= 100; brightness++)
+	{
+		led.brightness(brightness);
+		CHECK(led.brightness() == brightness);
+	}
+}
+
+int main()
+{
+	roundTrip();
+	manySaves();
+	tornWrites();
+	saveLed();
+
+	return report();
+}
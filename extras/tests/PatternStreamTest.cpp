@@ -0,0 +1,119 @@
+// PatternStreamTest.cpp
+// Host test of the PatternStream protocol: frames written by the sender
+// functions into a MemoryStream are parsed back and applied to a led
+//
+// Build and run from the library root: make -C extras test
+//
+// Covers the round trip of every frame type, and resynchronisation after
+// noise, in particular a stray SYNC whose bogus header swallows the SYNC of
+// the next real frame. Exit status 0 on success.
+
+#include <cstdio>
+#include "Arduino.h"
+#include "Check.h"
+#include "RGBLed.h"
+#include "PatternStream.h"
+
+static const int RED_PIN = 1, GREEN_PIN = 2, BLUE_PIN = 3;
+
+static void write(MemoryStream &stream, const uint8_t *bytes, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+		stream.write(bytes[i]);
+}
+
+// The led shows what the pattern shows at its start
+static bool showsStart(RGBLed &led, const Pattern &pattern)
+{
+	led.updatePattern(millis());
+	PatternSample sample = RGBLed::evaluate(pattern, 0);
+	return host::pwm(RED_PIN) == sample.rgb[0] && host::pwm(GREEN_PIN) == sample.rgb[1] &&
+		   host::pwm(BLUE_PIN) == sample.rgb[2];
+}
+
+static void roundTrip()
+{
+	RGBLed led(RED_PIN, GREEN_PIN, BLUE_PIN, RGBLed::COMMON_CATHODE);
+	PatternStream parser(led);
+	MemoryStream stream;
+	led.gamma(false);
+
+	Pattern blink = RGBLed::createBlinkPattern(200, 10, 30, 250, 750, 0, true);
+	CHECK(PatternStream::sendPattern(stream, blink));
+	CHECK(parser.poll(stream) == 1);
+	CHECK(led.isPatternActive());
+	CHECK(showsStart(led, blink));
+
+	PatternStream::sendBrightness(stream, 50);
+	CHECK(parser.poll(stream) == 1);
+	CHECK(host::pwm(RED_PIN) == 100); // Redrawn at half brightness
+	led.brightness(100);
+
+	Pattern fade = RGBLed::createFadePattern(0, 40, 0, 250, 40, 0, 2000, 0, true, EASE_IN_OUT);
+	CHECK(PatternStream::pushPattern(stream, fade, 5));
+	CHECK(parser.poll(stream) == 1);
+	CHECK(showsStart(led, fade));
+
+	PatternStream::sendStop(stream);
+	CHECK(parser.poll(stream) == 1);
+	CHECK(!led.isPatternActive());
+
+	// Programs reference a table, they cannot be sent
+	static const uint8_t program[] = {OP_SET, 1, 2, 3, OP_END};
+	CHECK(!PatternStream::sendPattern(stream, RGBLed::createProgramPattern(program, sizeof(program))));
+	CHECK(stream.available() == 0);
+
+	CHECK(parser.frames() == 4);
+	CHECK(parser.errors() == 0);
+}
+
+// Bytes in front of a valid frame must not cost the frame
+static void resync(const char *name, const uint8_t *noise, size_t length, unsigned long errors)
+{
+	RGBLed led(RED_PIN, GREEN_PIN, BLUE_PIN, RGBLed::COMMON_CATHODE);
+	PatternStream parser(led);
+	MemoryStream stream;
+	led.gamma(false);
+
+	Pattern pattern = RGBLed::createStaticPattern(0, 0, 90, 1000, true);
+	write(stream, noise, length);
+	CHECK(PatternStream::pushPattern(stream, pattern, 1));
+
+	uint8_t applied = parser.poll(stream, 255);
+	if (applied != 1 || parser.errors() != errors || !showsStart(led, pattern))
+	{
+		failures++;
+		printf("resync after %s: %u applied, %lu errors (expected 1, %lu)\n", name, applied, parser.errors(), errors);
+	}
+}
+
+int main()
+{
+	roundTrip();
+
+	const uint8_t SYNC = PatternStream::SYNC;
+
+	// A stray SYNC then a length that fits: the real SYNC arrives as the type
+	const uint8_t stray_length[] = {0x00, SYNC, 0x01};
+	resync("00 A5 01", stray_length, sizeof(stray_length), 1);
+
+	// A stray SYNC then a length that does not fit: the real SYNC is the length
+	const uint8_t stray_sync[] = {SYNC};
+	resync("A5", stray_sync, sizeof(stray_sync), 1);
+
+	// A complete frame with a bad CRC
+	const uint8_t bad_crc[] = {SYNC, 0x00, FRAME_STOP, 0x00};
+	resync("a bad CRC", bad_crc, sizeof(bad_crc), 1);
+
+	// A bad CRC that is itself a SYNC byte: it starts a frame of its own, the
+	// real SYNC then breaks that one as a length
+	uint8_t crc = PatternStream::crc8(PatternStream::crc8(0, 0x00), FRAME_STOP);
+	const uint8_t sync_crc[] = {SYNC, 0x00, FRAME_STOP, (uint8_t)(crc == SYNC ? 0x00 : SYNC)};
+	resync("a SYNC as the CRC", sync_crc, sizeof(sync_crc), 2);
+
+	// Noise without any SYNC
+	const uint8_t noise[] = {0x13, 0x37, 0xFF, 0x00, 0x42};
+	resync("noise", noise, sizeof(noise), 0);
+
+	return report();
+}
@@ -0,0 +1,130 @@
+// TickSourceTest.cpp
+// Host test of fixed-rate rendering: leds attached to a SimulatedTickSource
+// are rendered by advance() instead of updatePattern()
+//
+// Build and run from the library root: make -C extras test
+//
+// Covers the tick count at frequencies that do not divide 1000, the output
+// at each tick against RGBLed::evaluate(), changes from the main context
+// shown at the next tick, and a pending change written by detach().
+// Exit status 0 on success.
+
+#include <cstdio>
+#include "Arduino.h"
+#include "Check.h"
+#include "RGBLed.h"
+#include "SimulatedTickSource.h"
+
+static const int RED_PIN = 1, GREEN_PIN = 2, BLUE_PIN = 3;
+
+static bool shows(uint8_t red, uint8_t green, uint8_t blue)
+{
+	return host::pwm(RED_PIN) == red && host::pwm(GREEN_PIN) == green && host::pwm(BLUE_PIN) == blue;
+}
+
+// frequency ticks per simulated second, however the period rounds, also
+// when advanced in steps that split periods
+static void tickCount(uint16_t frequency, unsigned long step)
+{
+	SimulatedTickSource ticker;
+	CHECK(ticker.begin(frequency));
+
+	for (unsigned long ms = 0; ms < 10000; ms += step)
+		ticker.advance(ms + step <= 10000 ? step : 10000 - ms);
+	if (ticker.ticks() != 10UL * frequency)
+		printf("%u Hz in %lu ms steps: %lu ticks in 10 s\n", frequency, step, ticker.ticks());
+	CHECK(ticker.ticks() == 10UL * frequency);
+	CHECK(ticker.now() == 10000);
+
+	ticker.end();
+	ticker.advance(1000);
+	CHECK(ticker.ticks() == 10UL * frequency);
+}
+
+// Each tick shows the pattern at the tick time, nothing moves in between
+static void render()
+{
+	host::setMillis(0);
+	host::resetPwm();
+	SimulatedTickSource ticker;
+	RGBLed led(RED_PIN, GREEN_PIN, BLUE_PIN, RGBLed::COMMON_CATHODE);
+	led.gamma(false);
+
+	Pattern fade = RGBLed::createCrossfadePattern(255, 40, 0, 0, 90, 250, 700, 100, true);
+	led.callPattern(fade);
+	CHECK(ticker.attach(&led));
+	CHECK(!ticker.attach(&led));
+	CHECK(ticker.begin(300));
+	CHECK(led.updatePattern(0) == RGBLed::NO_DEADLINE);
+
+	unsigned long mismatches = 0, ticks = 0;
+	for (unsigned long ms = 1; ms <= 3000; ms++)
+	{
+		ticker.advance(1);
+		if (ticker.ticks() == ticks)
+			continue;
+		ticks = ticker.ticks();
+
+		PatternSample sample = RGBLed::evaluate(fade, ms);
+		if (!shows(sample.rgb[0], sample.rgb[1], sample.rgb[2]) && mismatches++ == 0)
+			printf("render: differs at %lu ms\n", ms);
+	}
+	CHECK(mismatches == 0);
+	CHECK(ticks == 900);
+
+	ticker.detach(&led);
+	ticker.end();
+}
+
+// With a ticker attached, only the tick writes: a color set from the main
+// context waits for it, or for detach()
+static void deferred()
+{
+	host::setMillis(0);
+	host::resetPwm();
+	SimulatedTickSource ticker;
+	RGBLed led(RED_PIN, GREEN_PIN, BLUE_PIN, RGBLed::COMMON_CATHODE);
+	led.gamma(false);
+	CHECK(ticker.attach(&led));
+	CHECK(ticker.begin(100));
+
+	led.setColor(10, 20, 30);
+	CHECK(shows(0, 0, 0));
+	ticker.advance(10);
+	CHECK(shows(10, 20, 30));
+
+	led.brightness(50);
+	CHECK(shows(10, 20, 30));
+	ticker.advance(10);
+	CHECK(shows(5, 10, 15));
+
+	led.setColor(200, 0, 0);
+	CHECK(shows(5, 10, 15));
+	ticker.detach(&led);
+	CHECK(shows(100, 0, 0));
+
+	// Detached: the led writes at once again, ticks render nothing
+	led.setColor(0, 0, 200);
+	CHECK(shows(0, 0, 100));
+	led.setColor(0, 200, 0);
+	ticker.advance(100);
+	CHECK(shows(0, 100, 0));
+}
+
+int main()
+{
+	tickCount(1000, 1);
+	tickCount(300, 1);
+	tickCount(300, 7);
+	tickCount(7, 1000);
+	tickCount(999, 3);
+
+	SimulatedTickSource ticker;
+	CHECK(!ticker.begin(0));
+	CHECK(!ticker.begin(1001));
+
+	render();
+	deferred();
+
+	return report();
+}
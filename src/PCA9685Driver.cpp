@@ -0,0 +1,112 @@
+#include "Arduino.h"
+#include "PCA9685Driver.h"
+
+PCA9685Driver::PCA9685Driver(I2CBus *bus, uint8_t address)
+    : _bus(bus),
+      _address(address),
+      _auto_flush(true),
+      _dirty(0)
+{
+    for (uint8_t ch = 0; ch < CHANNELS; ch++)
+        _value[ch] = 0;
+}
+
+bool PCA9685Driver::begin(uint16_t frequency)
+{
+    if (frequency < 24) frequency = 24;
+    if (frequency > 1526) frequency = 1526;
+
+    // prescale = round(25MHz / (4096 * frequency)) - 1
+    uint8_t prescale = (uint8_t)((25000000UL + 2048UL * frequency) / (4096UL * frequency) - 1);
+
+    // Prescaler can only be set while sleeping
+    bool ok = writeRegister(MODE1, 0x10);          // SLEEP
+    ok = writeRegister(PRE_SCALE, prescale) && ok;
+    ok = writeRegister(MODE1, 0x20) && ok;         // Wake, auto-increment
+    delay(1);                                      // Oscillator startup (500us)
+    ok = writeRegister(MODE2, 0x04) && ok;         // Totem pole outputs
+
+    // All outputs full off, matching the staged values
+    ok = writeRegister(ALL_LED_OFF_H, 0x10) && ok;
+    for (uint8_t ch = 0; ch < CHANNELS; ch++)
+        _value[ch] = 0;
+    _dirty = 0;
+
+    return ok;
+}
+
+void PCA9685Driver::setChannel(uint8_t channel, uint16_t value)
+{
+    if (channel >= CHANNELS)
+        return;
+    if (value > 4095)
+        value = 4095;
+
+    if (_value[channel] != value)
+    {
+        _value[channel] = value;
+        _dirty |= (uint16_t)1 << channel;
+    }
+}
+
+// Write each run of consecutive dirty channels in one auto-increment burst
+bool PCA9685Driver::flush()
+{
+    bool ok = true;
+    uint8_t ch = 0;
+
+    while (_dirty != 0 && ch < CHANNELS)
+    {
+        if (!(_dirty & ((uint16_t)1 << ch)))
+        {
+            ch++;
+            continue;
+        }
+
+        uint8_t buffer[1 + 4 * BURST_CHANNELS];
+        uint8_t length = 1;
+        buffer[0] = LED0_ON_L + 4 * ch;
+
+        while (ch < CHANNELS && (_dirty & ((uint16_t)1 << ch)) && length < sizeof(buffer))
+        {
+            uint16_t value = _value[ch];
+            uint16_t on = 0, off = value;
+
+            // Bit 4 of ON_H / OFF_H selects full on / full off
+            if (value == 0)
+                off = 0x1000;
+            else if (value >= 4095)
+            {
+                on = 0x1000;
+                off = 0;
+            }
+
+            buffer[length++] = on & 0xFF;
+            buffer[length++] = on >> 8;
+            buffer[length++] = off & 0xFF;
+            buffer[length++] = off >> 8;
+            _dirty &= ~((uint16_t)1 << ch);
+            ch++;
+        }
+
+        ok = _bus->write(_address, buffer, length) && ok;
+    }
+
+    return ok;
+}
+
+void PCA9685Driver::setAutoFlush(bool autoFlush)
+{
+    _auto_flush = autoFlush;
+}
+
+bool PCA9685Driver::autoFlush()
+{
+    return _auto_flush;
+}
+
+bool PCA9685Driver::writeRegister(uint8_t reg, uint8_t value)
+{
+    uint8_t buffer[2] = {reg, value};
+    return _bus->write(_address, buffer, 2);
+}
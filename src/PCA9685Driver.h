@@ -0,0 +1,79 @@
+/*
+ * PCA9685Driver.h
+ * Minimal PCA9685 backend shared by several RGBLed instances
+ *
+ * Channel updates are staged in RAM and written by flush() as
+ * auto-increment bursts, one I2C transaction per run of consecutive
+ * changed channels.
+ */
+
+#ifndef PCA9685_DRIVER_H
+#define PCA9685_DRIVER_H
+
+#include "Arduino.h"
+
+// Abstract I2C bus so the driver can run on Wire or on a mock (extras/host)
+class I2CBus
+{
+public:
+	virtual ~I2CBus() {}
+	// Write length bytes to the device, returns false on NACK/error
+	virtual bool write(uint8_t address, const uint8_t *data, uint8_t length) = 0;
+};
+
+// Adapter for TwoWire (pass Wire), templated to avoid a hard Wire.h dependency
+template <class TwoWireT>
+class WireI2CBus : public I2CBus
+{
+public:
+	WireI2CBus(TwoWireT &wire) : _wire(wire) {}
+
+	bool write(uint8_t address, const uint8_t *data, uint8_t length)
+	{
+		_wire.beginTransmission(address);
+		_wire.write(data, length);
+		return _wire.endTransmission() == 0;
+	}
+
+private:
+	TwoWireT &_wire;
+};
+
+class PCA9685Driver
+{
+public:
+	static const uint8_t CHANNELS = 16;
+
+	PCA9685Driver(I2CBus *bus, uint8_t address = 0x40);
+
+	// Set PWM frequency (Hz), enable auto-increment and turn all outputs off
+	bool begin(uint16_t frequency = 1000);
+
+	// Stage a 12-bit duty (0-4095) for a channel, written by flush()
+	void setChannel(uint8_t channel, uint16_t value);
+	bool flush();
+
+	// Flush after each RGBLed color change (default), disable to flush once per tick
+	void setAutoFlush(bool autoFlush);
+	bool autoFlush();
+
+private:
+	// Wire buffers are 32 bytes: register address + 7 channels of 4 bytes
+	static const uint8_t BURST_CHANNELS = 7;
+
+	static const uint8_t MODE1 = 0x00;
+	static const uint8_t MODE2 = 0x01;
+	static const uint8_t LED0_ON_L = 0x06;
+	static const uint8_t ALL_LED_OFF_H = 0xFD;
+	static const uint8_t PRE_SCALE = 0xFE;
+
+	I2CBus *_bus;
+	uint8_t _address;
+	bool _auto_flush;
+	uint16_t _value[CHANNELS];
+	uint16_t _dirty; // One bit per channel
+
+	bool writeRegister(uint8_t reg, uint8_t value);
+};
+
+#endif // PCA9685_DRIVER_H
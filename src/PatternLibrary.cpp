@@ -0,0 +1,12 @@
+#include "Arduino.h"
+#include "PatternLibrary.h"
+
+// Rainbow cycle keyframes: 1s ramp and 0.2s hold each
+const Keyframe PatternLibrary::RAINBOW_FRAMES[6] PROGMEM = {
+    {255, 0, 0, 1000, 200},     // Red
+    {255, 255, 0, 1000, 200},   // Yellow
+    {0, 255, 0, 1000, 200},     // Green
+    {0, 255, 255, 1000, 200},   // Cyan
+    {0, 0, 255, 1000, 200},     // Blue
+    {255, 0, 255, 1000, 200}    // Magenta
+};
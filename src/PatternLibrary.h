@@ -9,25 +9,32 @@
 
 #include "RGBLed.h"
 
+// Every preset is constexpr: store it in flash and run it with callPattern_P
+//   const Pattern IDLE PROGMEM = PatternLibrary::idle();
+//   led.callPattern_P(&IDLE);
 class PatternLibrary
 {
 public:
+    // Keyframe tables, stored in PROGMEM (PatternLibrary.cpp)
+    static const Keyframe RAINBOW_FRAMES[6];
+    
     // ===== STATUS INDICATORS =====
     
     // Idle state - slow blue breathing
-    static Pattern idle()
+    static constexpr Pattern idle()
     {
         return RGBLed::createFadePattern(
             0, 0, 50,      // Start: dim blue
             0, 0, 255,     // End: bright blue
-            2000,          // Fade time: 2s
-            1000,          // Off time: 1s
-            true           // Repeat
+            2000,          // Breath: 2s, up and back down
+            1000,          // Rest at dim blue: 1s
+            true,          // Repeat
+            EASE_SINE      // Breathing curve
         );
     }
     
     // Processing/busy - fast yellow blink
-    static Pattern processing()
+    static constexpr Pattern processing()
     {
         return RGBLed::createBlinkPattern(
             255, 255, 0,   // Yellow
@@ -39,7 +46,7 @@ public:
     }
     
     // Error state - red pulse
-    static Pattern error()
+    static constexpr Pattern error()
     {
         return RGBLed::createCrossfadePattern(
             50, 0, 0,      // From: dim red
@@ -52,7 +59,7 @@ public:
     }
     
     // Success - solid green for 2 seconds
-    static Pattern success()
+    static constexpr Pattern success()
     {
         return RGBLed::createStaticPattern(
             0, 255, 0,     // Green
@@ -62,7 +69,7 @@ public:
     }
     
     // Warning - orange blink
-    static Pattern warning()
+    static constexpr Pattern warning()
     {
         return RGBLed::createBlinkPattern(
             255, 165, 0,   // Orange
@@ -76,7 +83,7 @@ public:
     // ===== NOTIFICATION PATTERNS =====
     
     // New message - quick blue flash
-    static Pattern notification()
+    static constexpr Pattern notification()
     {
         return RGBLed::createBlinkPattern(
             0, 100, 255,   // Light blue
@@ -88,7 +95,7 @@ public:
     }
     
     // Attention needed - slow red blink
-    static Pattern attention()
+    static constexpr Pattern attention()
     {
         return RGBLed::createBlinkPattern(
             255, 0, 0,     // Red
@@ -102,7 +109,7 @@ public:
     // ===== SYSTEM STATES =====
     
     // Startup sequence - cyan to white fade
-    static Pattern startup()
+    static constexpr Pattern startup()
     {
         return RGBLed::createFadePattern(
             0, 255, 255,   // Start: cyan
@@ -114,7 +121,7 @@ public:
     }
     
     // Shutdown - white to off fade
-    static Pattern shutdown()
+    static constexpr Pattern shutdown()
     {
         return RGBLed::createFadePattern(
             255, 255, 255, // Start: white
@@ -126,7 +133,7 @@ public:
     }
     
     // Standby - dim yellow pulse
-    static Pattern standby()
+    static constexpr Pattern standby()
     {
         return RGBLed::createCrossfadePattern(
             20, 20, 0,     // From: very dim yellow
@@ -134,14 +141,15 @@ public:
             2000,          // Fade: 2s
             1000,          // Hold: 1s
             true,          // Reverse
-            true           // Repeat
+            true,          // Repeat
+            EASE_IN_OUT    // Slow start and end
         );
     }
     
     // ===== CHARGING/BATTERY PATTERNS =====
     
     // Charging - green pulse
-    static Pattern charging()
+    static constexpr Pattern charging()
     {
         return RGBLed::createCrossfadePattern(
             0, 50, 0,      // From: dim green
@@ -154,7 +162,7 @@ public:
     }
     
     // Low battery - red slow blink
-    static Pattern lowBattery()
+    static constexpr Pattern lowBattery()
     {
         return RGBLed::createBlinkPattern(
             255, 0, 0,     // Red
@@ -166,7 +174,7 @@ public:
     }
     
     // Full charge - solid green
-    static Pattern fullyCharged()
+    static constexpr Pattern fullyCharged()
     {
         return RGBLed::createStaticPattern(
             0, 255, 0,     // Green
@@ -177,33 +185,40 @@ public:
     
     // ===== DECORATIVE PATTERNS =====
     
-    // Rainbow cycle (red to green)
-    static Pattern rainbow()
+    // Rainbow cycle (red, yellow, green, cyan, blue, magenta)
+    static constexpr Pattern rainbow()
     {
-        return RGBLed::createCrossfadePattern(
-            255, 0, 0,     // Red
-            0, 255, 0,     // Green
-            2000,          // Fade: 2s
-            500,           // Hold: 0.5s
-            true,          // Reverse
+        return RGBLed::createSequencePattern(
+            RAINBOW_FRAMES, 6, // 6 keyframes, 1s ramp and 0.2s hold each
+            true,          // Stored in PROGMEM
             true           // Repeat
         );
     }
     
+    // Color wheel, smooth hue rotation at full saturation
+    static constexpr Pattern colorWheel()
+    {
+        return RGBLed::createHueCyclePattern(
+            6000,          // One turn: 6s
+            255, 255       // Full saturation and value
+        );
+    }
+    
     // Breathing white
-    static Pattern breathingWhite()
+    static constexpr Pattern breathingWhite()
     {
         return RGBLed::createFadePattern(
             10, 10, 10,    // Start: very dim
             255, 255, 255, // End: bright white
-            2000,          // Fade: 2s
-            1000,          // Off: 1s
-            true           // Repeat
+            2000,          // Breath: 2s, up and back down
+            1000,          // Rest: 1s
+            true,          // Repeat
+            EASE_SINE      // Breathing curve
         );
     }
     
     // Party mode - fast multi-color
-    static Pattern party()
+    static constexpr Pattern party()
     {
         return RGBLed::createCrossfadePattern(
             255, 0, 255,   // Magenta
@@ -218,7 +233,7 @@ public:
     // ===== TEMPERATURE INDICATORS =====
     
     // Cool - blue static
-    static Pattern cool()
+    static constexpr Pattern cool()
     {
         return RGBLed::createStaticPattern(
             0, 100, 255,   // Light blue
@@ -228,7 +243,7 @@ public:
     }
     
     // Warm - orange/red fade
-    static Pattern warm()
+    static constexpr Pattern warm()
     {
         return RGBLed::createCrossfadePattern(
             255, 165, 0,   // Orange
@@ -241,7 +256,7 @@ public:
     }
     
     // Overheat - fast red blink
-    static Pattern overheat()
+    static constexpr Pattern overheat()
     {
         return RGBLed::createBlinkPattern(
             255, 0, 0,     // Bright red
@@ -255,7 +270,7 @@ public:
     // ===== CONNECTIVITY PATTERNS =====
     
     // Connecting - cyan pulse
-    static Pattern connecting()
+    static constexpr Pattern connecting()
     {
         return RGBLed::createCrossfadePattern(
             0, 100, 100,   // Dim cyan
@@ -268,7 +283,7 @@ public:
     }
     
     // Connected - solid green
-    static Pattern connected()
+    static constexpr Pattern connected()
     {
         return RGBLed::createStaticPattern(
             0, 255, 0,     // Green
@@ -278,7 +293,7 @@ public:
     }
     
     // Disconnected - red blink
-    static Pattern disconnected()
+    static constexpr Pattern disconnected()
     {
         return RGBLed::createBlinkPattern(
             255, 0, 0,     // Red
@@ -292,7 +307,7 @@ public:
     // ===== OFF STATE =====
     
     // Turn off
-    static Pattern off()
+    static constexpr Pattern off()
     {
         return RGBLed::createStaticPattern(
             0, 0, 0,       // Off
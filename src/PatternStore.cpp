@@ -0,0 +1,181 @@
+#include "Arduino.h"
+#include "PatternStore.h"
+#include "PatternStream.h"
+
+// Record layout
+static const uint8_t RECORD_MAGIC = 0;
+static const uint8_t RECORD_VERSION = 1;
+static const uint8_t RECORD_SEQUENCE = 2;
+static const uint8_t RECORD_PATTERN = 3;
+static const uint8_t RECORD_BRIGHTNESS = RECORD_PATTERN + sizeof(PackedPattern);
+static const uint8_t RECORD_CRC = RECORD_BRIGHTNESS + 1;
+
+static_assert(RECORD_CRC + 1 == PatternStore::RECORD_SIZE, "PatternStore record layout");
+
+PatternStore::PatternStore(PatternStorage *storage, uint16_t address)
+    : _storage(storage),
+      _address(address)
+{
+}
+
+// The new record goes to the copy that is not the latest, a write cut short
+// leaves the latest one intact
+bool PatternStore::save(const Pattern &pattern, uint8_t brightness)
+{
+    if (pattern.type == PATTERN_SEQUENCE || pattern.type == PATTERN_PROGRAM)
+        return false;
+
+    uint8_t record[RECORD_SIZE];
+    record[RECORD_MAGIC] = MAGIC;
+    record[RECORD_VERSION] = VERSION;
+    record[RECORD_SEQUENCE] = 0;
+    PatternStream::encodePacked(RGBLed::packPattern(pattern), record + RECORD_PATTERN);
+    record[RECORD_BRIGHTNESS] = brightness > 100 ? 100 : brightness;
+
+    uint8_t latest[RECORD_SIZE];
+    int8_t copy = readLatest(latest);
+    if (copy >= 0)
+    {
+        // Same content: nothing to write
+        if (memcmp(latest + RECORD_PATTERN, record + RECORD_PATTERN, RECORD_CRC - RECORD_PATTERN) == 0)
+            return true;
+        record[RECORD_SEQUENCE] = latest[RECORD_SEQUENCE] + 1;
+    }
+    record[RECORD_CRC] = checksum(record);
+
+    return writeChanged(copy == 0 ? 1 : 0, record);
+}
+
+bool PatternStore::load(Pattern &pattern, uint8_t &brightness)
+{
+    uint8_t record[RECORD_SIZE];
+
+    if (readLatest(record) < 0)
+        return false;
+
+    PackedPattern packed;
+    memset(&packed, 0, sizeof(packed));
+    for (uint8_t i = 0; i < sizeof(PackedPattern); i++)
+        PatternStream::decodePacked(packed, i, record[RECORD_PATTERN + i]);
+    if (!PatternStream::playable(packed))
+        return false;
+
+    pattern = RGBLed::unpackPattern(packed);
+    brightness = record[RECORD_BRIGHTNESS];
+    return true;
+}
+
+bool PatternStore::save(const RGBLed &led)
+{
+    const Pattern *pattern = led.currentPattern();
+    if (pattern == nullptr)
+        return false;
+
+    return save(*pattern, led.brightness());
+}
+
+bool PatternStore::restore(RGBLed &led)
+{
+    Pattern pattern;
+    uint8_t brightness;
+
+    if (!load(pattern, brightness))
+        return false;
+
+    led.brightness(brightness);
+    led.callPattern(pattern);
+    return true;
+}
+
+bool PatternStore::clear()
+{
+    bool changed = false;
+
+    for (uint8_t copy = 0; copy < 2; copy++)
+    {
+        uint16_t address = _address + copy * RECORD_SIZE + RECORD_MAGIC;
+        uint8_t magic;
+
+        if (!_storage->read(address, &magic, 1))
+            return false;
+        if (magic != MAGIC)
+            continue;
+
+        magic = 0;
+        if (!_storage->write(address, &magic, 1))
+            return false;
+        changed = true;
+    }
+    return !changed || _storage->commit();
+}
+
+// CRC-8 of the record up to the CRC byte
+uint8_t PatternStore::checksum(const uint8_t *record)
+{
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < RECORD_CRC; i++)
+        crc = PatternStream::crc8(crc, record[i]);
+    return crc;
+}
+
+// A record is valid when it is of this version and its CRC matches
+bool PatternStore::readRecord(uint8_t copy, uint8_t *record)
+{
+    if (!_storage->read(_address + copy * RECORD_SIZE, record, RECORD_SIZE))
+        return false;
+    if (record[RECORD_MAGIC] != MAGIC || record[RECORD_VERSION] != VERSION)
+        return false;
+    return record[RECORD_CRC] == checksum(record);
+}
+
+// Read the newest valid copy into record, returns its index or -1. The
+// sequence number wraps, the newer copy is the one at most 127 ahead.
+int8_t PatternStore::readLatest(uint8_t *record)
+{
+    uint8_t other[RECORD_SIZE];
+    bool first = readRecord(0, record);
+    bool second = readRecord(1, other);
+
+    if (second && (!first || (uint8_t)(other[RECORD_SEQUENCE] - record[RECORD_SEQUENCE]) < 128))
+    {
+        memcpy(record, other, RECORD_SIZE);
+        return 1;
+    }
+    return first ? 0 : -1;
+}
+
+// Wear: rewrite only the runs of bytes that differ, commit only if any did.
+// The magic byte goes last, after it was cleared: a write cut short leaves
+// a copy without it, not a mix of old and new bytes that may pass the CRC.
+bool PatternStore::writeChanged(uint8_t copy, const uint8_t *record)
+{
+    uint16_t address = _address + copy * RECORD_SIZE;
+    uint8_t stored[RECORD_SIZE];
+
+    if (!_storage->read(address, stored, RECORD_SIZE))
+        return false;
+    if (memcmp(stored, record, RECORD_SIZE) == 0)
+        return true;
+
+    uint8_t invalid = 0;
+    if (stored[RECORD_MAGIC] == MAGIC && !_storage->write(address + RECORD_MAGIC, &invalid, 1))
+        return false;
+
+    uint8_t i = RECORD_MAGIC + 1;
+    while (i < RECORD_SIZE)
+    {
+        if (stored[i] == record[i])
+        {
+            i++;
+            continue;
+        }
+
+        uint8_t start = i;
+        while (i < RECORD_SIZE && stored[i] != record[i])
+            i++;
+        if (!_storage->write(address + start, record + start, i - start))
+            return false;
+    }
+
+    return _storage->write(address + RECORD_MAGIC, record + RECORD_MAGIC, 1) && _storage->commit();
+}
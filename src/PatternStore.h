@@ -0,0 +1,98 @@
+/*
+ * PatternStore.h
+ * Keep the active pattern and brightness across resets
+ *
+ * Two copies of a fixed-size record (17 bytes each) at a chosen address of
+ * a storage backend: magic, version, sequence number, PackedPattern
+ * (PatternStream wire order), brightness, CRC-8. The valid copy with the
+ * newest sequence number is the stored pattern. save() writes the other
+ * copy, so a reset during a save keeps the previous pattern. It only writes
+ * the bytes that changed, nothing at all when the content is the same.
+ */
+
+#ifndef PATTERN_STORE_H
+#define PATTERN_STORE_H
+
+#include "RGBLed.h"
+
+// Abstract storage so the store can run on EEPROM, a flash page or a mock.
+// A flash backend keeps the page in RAM and erases/programs it in commit().
+class PatternStorage
+{
+public:
+	virtual ~PatternStorage() {}
+	// Return false on error
+	virtual bool read(uint16_t address, uint8_t *data, uint8_t length) = 0;
+	virtual bool write(uint16_t address, const uint8_t *data, uint8_t length) = 0;
+	// Called once after the writes of a save()
+	virtual bool commit() { return true; }
+};
+
+// Adapter for the EEPROM library (pass EEPROM), templated to avoid a hard
+// EEPROM.h dependency. On ESP32 call EEPROM.begin(size) first.
+template <class EEPROMT>
+class EEPROMStorage : public PatternStorage
+{
+public:
+	EEPROMStorage(EEPROMT &eeprom) : _eeprom(eeprom) {}
+
+	bool read(uint16_t address, uint8_t *data, uint8_t length)
+	{
+		for (uint8_t i = 0; i < length; i++)
+			data[i] = _eeprom.read(address + i);
+		return true;
+	}
+
+	bool write(uint16_t address, const uint8_t *data, uint8_t length)
+	{
+		for (uint8_t i = 0; i < length; i++)
+			_eeprom.write(address + i, data[i]);
+		return true;
+	}
+
+#if defined(ESP32)
+	// The ESP32 EEPROM is a RAM copy of a flash sector
+	bool commit() { return _eeprom.commit(); }
+#endif
+
+private:
+	EEPROMT &_eeprom;
+};
+
+class PatternStore
+{
+public:
+	static const uint8_t MAGIC = 0x52;
+	static const uint8_t VERSION = 2; // Records of another version are ignored
+	static const uint8_t RECORD_SIZE = 17;
+	static const uint8_t STORAGE_SIZE = 2 * RECORD_SIZE; // Bytes used from the address
+
+	PatternStore(PatternStorage *storage, uint16_t address = 0);
+
+	// Store a pattern and brightness (0-100), false when it cannot be stored
+	// (sequences and programs) or the backend fails
+	bool save(const Pattern &pattern, uint8_t brightness);
+	// The pattern running on led (e.g. received by a PatternStream) and its
+	// brightness, false when none runs
+	bool save(const RGBLed &led);
+
+	// Read the record back, false when there is none or it is corrupt
+	bool load(Pattern &pattern, uint8_t &brightness);
+
+	// Start the stored pattern on led at its brightness, at boot
+	bool restore(RGBLed &led);
+
+	// Invalidate both copies (one byte each), restore() then does nothing
+	bool clear();
+
+private:
+	PatternStorage *_storage;
+	uint16_t _address;
+
+	static uint8_t checksum(const uint8_t *record);
+	bool readRecord(uint8_t copy, uint8_t *record);
+	int8_t readLatest(uint8_t *record);
+	bool writeChanged(uint8_t copy, const uint8_t *record);
+};
+
+#endif // PATTERN_STORE_H
@@ -0,0 +1,251 @@
+#include "Arduino.h"
+#include "PatternStream.h"
+
+PatternStream::PatternStream(RGBLed &led)
+    : _led(led),
+      _frames(0),
+      _errors(0)
+{
+    reset();
+}
+
+// Drain what is already buffered, a partial frame waits for the next call
+uint8_t PatternStream::poll(Stream &in, uint8_t max_bytes)
+{
+    uint8_t applied = 0;
+
+    while (max_bytes-- > 0 && in.available() > 0)
+    {
+        int byte = in.read();
+        if (byte < 0)
+            break;
+        if (feed((uint8_t)byte))
+            applied++;
+    }
+    return applied;
+}
+
+bool PatternStream::feed(uint8_t byte)
+{
+    switch (_state)
+    {
+    case WAIT_SYNC:
+        if (byte == SYNC)
+        {
+            _crc = 0;
+            _state = READ_LENGTH;
+        }
+        return false;
+
+    case READ_LENGTH:
+        if (byte > MAX_PAYLOAD)
+        {
+            drop(byte);
+            return false;
+        }
+        _length = byte;
+        _crc = crc8(_crc, byte);
+        _state = READ_TYPE;
+        return false;
+
+    case READ_TYPE:
+        // The length is known per type, a mismatch is dropped before the payload
+        if (payloadLength(byte) != _length)
+        {
+            drop(byte);
+            return false;
+        }
+        _type = byte;
+        _index = 0;
+        _crc = crc8(_crc, byte);
+        memset(&_packed, 0, sizeof(_packed));
+        _state = _length > 0 ? READ_PAYLOAD : READ_CRC;
+        return false;
+
+    case READ_PAYLOAD:
+        store(byte);
+        _crc = crc8(_crc, byte);
+        if (++_index >= _length)
+            _state = READ_CRC;
+        return false;
+
+    default:
+        if (byte != _crc)
+        {
+            drop(byte);
+            return false;
+        }
+        _state = WAIT_SYNC;
+        if (!apply())
+        {
+            _errors++;
+            return false;
+        }
+        _frames++;
+        return true;
+    }
+}
+
+void PatternStream::reset()
+{
+    _state = WAIT_SYNC;
+    _length = 0;
+    _type = 0;
+    _index = 0;
+    _crc = 0;
+}
+
+// Bad header or CRC: count it and hunt for the next sync byte, starting
+// with the one that broke the frame (a stray sync before a real frame)
+void PatternStream::drop(uint8_t byte)
+{
+    _errors++;
+    _state = WAIT_SYNC;
+    feed(byte);
+}
+
+// Payload length of each frame type, 0xFF for unknown types
+uint8_t PatternStream::payloadLength(uint8_t type)
+{
+    switch (type)
+    {
+    case FRAME_PATTERN:
+        return sizeof(PackedPattern);
+    case FRAME_STOP:
+        return 0;
+    case FRAME_BRIGHTNESS:
+        return 1;
+    case FRAME_PUSH:
+        return sizeof(PackedPattern) + 1;
+    default:
+        return 0xFF;
+    }
+}
+
+// Route one payload byte to the pattern or the trailing value
+void PatternStream::store(uint8_t byte)
+{
+    if (_type == FRAME_BRIGHTNESS || _index >= sizeof(PackedPattern))
+        _value = byte;
+    else
+        decodePacked(_packed, _index, byte);
+}
+
+// PackedPattern in wire order, durations little-endian
+void PatternStream::encodePacked(const PackedPattern &packed, uint8_t *out)
+{
+    out[0] = packed.time[0] & 0xFF;
+    out[1] = packed.time[0] >> 8;
+    out[2] = packed.time[1] & 0xFF;
+    out[3] = packed.time[1] >> 8;
+    out[4] = packed.flags;
+    memcpy(out + 5, packed.rgb, 6);
+    out[11] = packed.count;
+}
+
+// Byte index of the wire order into its field, time must start at 0
+void PatternStream::decodePacked(PackedPattern &packed, uint8_t index, uint8_t byte)
+{
+    if (index < 4)
+        packed.time[index >> 1] |= (uint16_t)byte << ((index & 1) * 8);
+    else if (index == 4)
+        packed.flags = byte;
+    else if (index < 11)
+        packed.rgb[index - 5] = byte;
+    else
+        packed.count = byte;
+}
+
+// Only self-contained types with a known easing can be played
+bool PatternStream::playable(const PackedPattern &packed)
+{
+    uint8_t type = packed.flags & PACKED_TYPE_MASK;
+
+    if (type == PATTERN_SEQUENCE || type == PATTERN_PROGRAM || type > PATTERN_HUE_CYCLE)
+        return false;
+    return !((type == PATTERN_FADE || type == PATTERN_CROSSFADE) && packed.count > EASE_SINE);
+}
+
+// Run a checked frame, false when its pattern cannot be played
+bool PatternStream::apply()
+{
+    if (_type == FRAME_STOP)
+    {
+        _led.stopPattern();
+        return true;
+    }
+    if (_type == FRAME_BRIGHTNESS)
+    {
+        _led.brightness(_value);
+        return true;
+    }
+
+    if (!playable(_packed))
+        return false;
+
+    if (_type == FRAME_PUSH)
+        return _led.pushPattern(RGBLed::unpackPattern(_packed), _value);
+
+    _led.callPattern(&_packed);
+    return true;
+}
+
+// CRC-8, polynomial 0x07, bitwise (no table in flash)
+uint8_t PatternStream::crc8(uint8_t crc, uint8_t byte)
+{
+    crc ^= byte;
+    for (uint8_t bit = 0; bit < 8; bit++)
+        crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    return crc;
+}
+
+bool PatternStream::sendPattern(Print &out, const Pattern &pattern)
+{
+    return sendFrame(out, FRAME_PATTERN, &pattern, 0);
+}
+
+bool PatternStream::pushPattern(Print &out, const Pattern &pattern, uint8_t priority)
+{
+    return sendFrame(out, FRAME_PUSH, &pattern, priority);
+}
+
+void PatternStream::sendStop(Print &out)
+{
+    sendFrame(out, FRAME_STOP, nullptr, 0);
+}
+
+void PatternStream::sendBrightness(Print &out, uint8_t brightness)
+{
+    sendFrame(out, FRAME_BRIGHTNESS, nullptr, brightness);
+}
+
+// Write one frame
+bool PatternStream::sendFrame(Print &out, uint8_t type, const Pattern *pattern, uint8_t value)
+{
+    uint8_t payload[sizeof(PackedPattern) + 1];
+    uint8_t length = payloadLength(type);
+
+    if (pattern != nullptr)
+    {
+        if (pattern->type == PATTERN_SEQUENCE || pattern->type == PATTERN_PROGRAM)
+            return false;
+
+        encodePacked(RGBLed::packPattern(*pattern), payload);
+        payload[12] = value; // Priority, sent by FRAME_PUSH only
+    }
+    else
+    {
+        payload[0] = value;
+    }
+
+    uint8_t crc = crc8(crc8(0, length), type);
+    for (uint8_t i = 0; i < length; i++)
+        crc = crc8(crc, payload[i]);
+
+    out.write(SYNC);
+    out.write(length);
+    out.write(type);
+    out.write(payload, length);
+    out.write(crc);
+    return true;
+}
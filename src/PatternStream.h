@@ -0,0 +1,95 @@
+/*
+ * PatternStream.h
+ * Framed binary protocol to change a led's pattern at runtime over any
+ * Stream (Serial, Bluetooth serial, a TCP client...)
+ *
+ * Frame: SYNC, length, type, payload (length bytes), CRC-8
+ * The CRC (polynomial 0x07) covers length, type and payload. Patterns
+ * travel as a PackedPattern, multi-byte fields little-endian. Sequence and
+ * program patterns reference tables and cannot be sent.
+ *
+ * The parser takes one byte at a time and decodes the payload straight into
+ * its PackedPattern, there is no frame buffer. A bad frame is dropped and the
+ * parser hunts for the next SYNC, the byte that broke the frame included.
+ */
+
+#ifndef PATTERN_STREAM_H
+#define PATTERN_STREAM_H
+
+#include "RGBLed.h"
+
+// Frame types
+enum PatternFrameType
+{
+	FRAME_PATTERN = 1,	  // PackedPattern (12 bytes), callPattern()
+	FRAME_STOP = 2,		  // No payload, stopPattern()
+	FRAME_BRIGHTNESS = 3, // Brightness 0-100 (1 byte)
+	FRAME_PUSH = 4		  // PackedPattern then priority (13 bytes), pushPattern()
+};
+
+class PatternStream
+{
+public:
+	static const uint8_t SYNC = 0xA5;
+	static const uint8_t MAX_PAYLOAD = sizeof(PackedPattern) + 1;
+
+	PatternStream(RGBLed &led);
+
+	// Read what the stream has, up to max_bytes, and never wait for more.
+	// Returns the number of frames applied.
+	uint8_t poll(Stream &in, uint8_t max_bytes = 32);
+
+	// Parse one byte, returns true when it completed a valid frame
+	bool feed(uint8_t byte);
+
+	// Forget a partial frame
+	void reset();
+
+	// Frames applied, and frames dropped (bad length, type or CRC)
+	unsigned long frames() { return _frames; }
+	unsigned long errors() { return _errors; }
+
+	// Sender side, returns false when the pattern cannot be sent
+	static bool sendPattern(Print &out, const Pattern &pattern);
+	static bool pushPattern(Print &out, const Pattern &pattern, uint8_t priority);
+	static void sendStop(Print &out);
+	static void sendBrightness(Print &out, uint8_t brightness);
+
+	// Wire format, shared with PatternStore
+	static uint8_t crc8(uint8_t crc, uint8_t byte);
+	static void encodePacked(const PackedPattern &packed, uint8_t *out);
+	static void decodePacked(PackedPattern &packed, uint8_t index, uint8_t byte);
+	static bool playable(const PackedPattern &packed);
+
+private:
+	enum State
+	{
+		WAIT_SYNC,
+		READ_LENGTH,
+		READ_TYPE,
+		READ_PAYLOAD,
+		READ_CRC
+	};
+
+	RGBLed &_led;
+	uint8_t _state;
+	uint8_t _length;
+	uint8_t _type;
+	uint8_t _index; // Payload bytes read
+	uint8_t _crc;
+
+	// Payload, decoded in place
+	PackedPattern _packed;
+	uint8_t _value; // Brightness or priority
+
+	unsigned long _frames;
+	unsigned long _errors;
+
+	static uint8_t payloadLength(uint8_t type);
+	void store(uint8_t byte);
+	bool apply();
+	void drop(uint8_t byte);
+	static bool sendFrame(Print &out, uint8_t type, const Pattern *pattern, uint8_t value);
+};
+
+#endif // PATTERN_STREAM_H
@@ -1,5 +1,6 @@
 #include "Arduino.h"
 #include "RGBLed.h"
+#include "RGBLedLock.h"
 
 // Static color definitions
 int RGBLed::RED[3] = {255, 0, 0};
@@ -10,26 +11,149 @@ int RGBLed::CYAN[3] = {0, 255, 255};
 int RGBLed::YELLOW[3] = {255, 255, 0};
 int RGBLed::WHITE[3] = {255, 255, 255};
 
+#if defined(ESP32)
+static StaticSemaphore_t rgbled_mutex_buffer;
+static SemaphoreHandle_t rgbled_mutex = nullptr;
+static portMUX_TYPE rgbled_mutex_init = portMUX_INITIALIZER_UNLOCKED;
+
+// The mutex is created on first use, global leds may lock before setup().
+// Before the scheduler runs there is nothing to lock against.
+void rgbledLock()
+{
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
+        return;
+    if (rgbled_mutex == nullptr)
+    {
+        portENTER_CRITICAL(&rgbled_mutex_init);
+        if (rgbled_mutex == nullptr)
+            rgbled_mutex = xSemaphoreCreateRecursiveMutexStatic(&rgbled_mutex_buffer);
+        portEXIT_CRITICAL(&rgbled_mutex_init);
+    }
+    xSemaphoreTakeRecursive(rgbled_mutex, portMAX_DELAY);
+}
+
+void rgbledUnlock()
+{
+    if (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)
+        return;
+    xSemaphoreGiveRecursive(rgbled_mutex);
+}
+#elif !defined(__AVR__) && !defined(ESP8266) && !(defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M')
+volatile uint8_t rgbled_lock_depth = 0;
+#endif
+
+// Pattern state is only shared with an attached tick source: without one,
+// nothing is locked
+#define RGBLED_LOCK_TICK() RGBLED_LOCK_IF(_tick_source != nullptr)
+#define RGBLED_UNLOCK_TICK() RGBLED_UNLOCK_IF()
+
 bool RGBLed::COMMON_ANODE = true;
 bool RGBLed::COMMON_CATHODE = false;
 
-// Constructor for direct connection
-RGBLed::RGBLed(int red, int green, int blue, bool common) 
-    : _connection_type(DIRECT_CONNECTION),
-      _red_pin(red), 
-      _green_pin(green), 
-      _blue_pin(blue), 
-      _common(common), 
-      _brightness(100),
+// Easing curves in Q16, 16 segments interpolated linearly (EASE_IN first)
+static const uint16_t EASE_TABLE[4][17] PROGMEM = {
+    {0, 256, 1024, 2304, 4096, 6400, 9216, 12544, 16384, 20736, 25600, 30976, 36863, 43263, 50175, 57599, 65535},
+    {0, 7936, 15360, 22272, 28672, 34559, 39935, 44799, 49151, 52991, 56319, 59135, 61439, 63231, 64511, 65279, 65535},
+    {0, 630, 2494, 5522, 9597, 14563, 20228, 26375, 32767, 39160, 45307, 50972, 55938, 60013, 63041, 64905, 65535},
+    {0, 2494, 9597, 20228, 32767, 45307, 55938, 63041, 65535, 63041, 55938, 45307, 32768, 20228, 9597, 2494, 0},
+};
+
+// Gamma 2.2 correction, non-zero inputs stay lit
+static const uint8_t GAMMA_TABLE[256] PROGMEM = {
+      0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+// Direct connection, from the constructor
+void RGBLed::connectPins(int red, int green, int blue, bool common)
+{
+    _connection_type = DIRECT_CONNECTION;
+    _red_pin = red;
+    _green_pin = green;
+    _blue_pin = blue;
+    _invert = common == COMMON_ANODE ? 0xFF : 0;
+    initHardware();
+}
+
+// Every public constructor starts from this one: the pattern engine runs,
+// nothing is written until a connection is set
+RGBLed::RGBLed(RGBLED_CONFIG)
+    : _connection_type(NO_CONNECTION),
+      _red_pin(-1),
+      _green_pin(-1),
+      _blue_pin(-1),
+#ifdef USE_I2C_PWM
+      _pwm_driver(nullptr),
+      _red_channel(0),
+      _green_channel(0),
+      _blue_channel(0),
+#endif
+      _invert(0),
+      _scale(256),
+      _gamma(false),
+      _duty_valid(false),
+      _writes_issued(0),
+      _writes_skipped(0),
       _current_pattern(nullptr),
       _pattern_active(false),
       _pattern_start_time(0),
-      _last_update_time(0),
-      _pattern_state(0),
-      _blink_count(0),
-      _fade_progress(0.0f),
-      _fade_direction(true)
+      _pattern_pending(false),
+      _wake_from(0),
+      _wake_for(0),
+      _timeline(),
+      _cursor(),
+      _free_count(0),
+      _slot(NO_SLOT),
+      _transient(false),
+      _layer_count(0),
+      _priority(0),
+      _blend_source(nullptr),
+      _blend_mode(BLEND_MULTIPLY),
+      _blend_alpha(128),
+#if RGBLED_COMMAND_SLOTS > 0
+      _command_head(0),
+      _command_tail(0),
+#endif
+      _tick_source(nullptr),
+      _tick_next(nullptr),
+      _redraw(false)
+{
+    RGBLED_STAT(resetStats());
+    initSlots();
+}
+
+#ifdef USE_I2C_PWM
+// I2C PWM connection, the driver is shared and begin() is up to the caller
+void RGBLed::connectDriver(PCA9685Driver *pwm, uint8_t red_channel, uint8_t green_channel, uint8_t blue_channel, bool common)
 {
+    _connection_type = I2C_PWM_CONNECTION;
+    _pwm_driver = pwm;
+    _red_channel = red_channel;
+    _green_channel = green_channel;
+    _blue_channel = blue_channel;
+    _invert = common == COMMON_ANODE ? 0xFF : 0;
+}
+#endif
+
+void RGBLed::initHardware()
+{
+    if (_connection_type != DIRECT_CONNECTION)
+        return;
+
 #if defined(ESP32)
     // ESP32-S2 compatible LEDC setup
     ledcSetup(0, 5000, 8);      // Channel 0, 5kHz, 8-bit resolution
@@ -48,38 +172,57 @@ RGBLed::RGBLed(int red, int green, int blue, bool common)
 
 void RGBLed::off()
 {
-    color(0, 0, 0);
+    intensity(0, 0, 0);
 }
 
 void RGBLed::brightness(int rgb[3], int brightness)
 {
-    _brightness = brightness;
-    intensity(rgb[0], rgb[1], rgb[2], brightness);
+    this->brightness(rgb[0], rgb[1], rgb[2], brightness);
 }
 
 void RGBLed::brightness(int red, int green, int blue, int brightness)
 {
-    _brightness = brightness;
-    intensity(red, green, blue, brightness);
+    RGBLED_LOCK_TICK();
+    _scale = brightnessScale(brightness);
+    RGBLED_UNLOCK_TICK();
+    intensity(red, green, blue);
 }
 
 void RGBLed::brightness(int brightness)
 {
-    _brightness = brightness;
+    RGBLED_LOCK_TICK();
+    _scale = brightnessScale(brightness);
+    show(); // A held color would otherwise keep the old level
+    RGBLED_UNLOCK_TICK();
+}
+
+// The scale has more steps than the percentage, so this is exact
+int RGBLed::brightness() const
+{
+    return ((unsigned long)_scale * 100 + 128) >> 8;
 }
 
-void RGBLed::intensity(int red, int green, int blue, int brightness)
+// Brightness is kept as a Q8 scale (0-256) so intensity() needs no divide
+uint16_t RGBLed::brightnessScale(int brightness)
 {
     if (brightness > 100) brightness = 100;
     if (brightness < 0) brightness = 0;
+    return ((uint16_t)brightness * 256 + 50) / 100;
+}
+
+void RGBLed::gamma(bool enabled)
+{
+    _gamma = enabled;
+}
 
-    red = (red * brightness) / 100;
-    green = (green * brightness) / 100;
-    blue = (blue * brightness) / 100;
-    color(red, green, blue);
+// Brightness, gamma and common anode inversion: one multiply and one lookup per channel
+uint8_t RGBLed::output(uint8_t value, uint16_t scale, bool gamma)
+{
+    uint8_t level = ((uint16_t)value * scale) >> 8;
+    return gamma ? pgm_read_byte(&GAMMA_TABLE[level]) : level;
 }
 
-void RGBLed::color(int red, int green, int blue)
+void RGBLed::intensity(int red, int green, int blue)
 {
     // Constrain values
     if (red < 0) red = 0;
@@ -89,136 +232,315 @@ void RGBLed::color(int red, int green, int blue)
     if (blue < 0) blue = 0;
     if (blue > 255) blue = 255;
 
-    if (_common == COMMON_ANODE)
+    _shown[0] = red;
+    _shown[1] = green;
+    _shown[2] = blue;
+    show();
+}
+
+// Compositor stage, then the hardware. An attached tick source owns the
+// hardware: the output is only marked here and written at the end of its
+// next render, never from a locked section (an I2C transfer would wait
+// forever with interrupts off).
+void RGBLed::show()
+{
+    if (_blend_source != nullptr)
     {
-#if defined(ESP32)
-        ledcWrite(0, 255 - red);
-        ledcWrite(1, 255 - green);
-        ledcWrite(2, 255 - blue);
-#else
-        analogWrite(_red_pin, 255 - red);
-        analogWrite(_green_pin, 255 - green);
-        analogWrite(_blue_pin, 255 - blue);
-#endif
+        const uint8_t *source = _blend_source->_output;
+        _output[0] = blendChannel(_shown[0], source[0], _blend_mode, _blend_alpha);
+        _output[1] = blendChannel(_shown[1], source[1], _blend_mode, _blend_alpha);
+        _output[2] = blendChannel(_shown[2], source[2], _blend_mode, _blend_alpha);
     }
     else
     {
+        memcpy(_output, _shown, 3);
+    }
+
+    if (_connection_type == NO_CONNECTION)
+        return;
+    if (_tick_source != nullptr)
+    {
+        _redraw = true;
+        return;
+    }
+    writeOutput();
+}
+
+void RGBLed::writeOutput()
+{
+    writeChannel(0, output(_output[0], _scale, _gamma) ^ _invert);
+    writeChannel(1, output(_output[1], _scale, _gamma) ^ _invert);
+    writeChannel(2, output(_output[2], _scale, _gamma) ^ _invert);
+    _duty_valid = true;
+    flushPWM(false);
+}
+
+// One multiply at most per channel, no divide
+uint8_t RGBLed::blendChannel(uint8_t a, uint8_t b, uint8_t mode, uint8_t alpha)
+{
+    switch (mode)
+    {
+    case BLEND_MULTIPLY:
+        return ((uint16_t)a * b + 255) >> 8;
+    case BLEND_ADD:
+        return (uint16_t)a + b > 255 ? 255 : a + b;
+    case BLEND_MAX:
+        return a > b ? a : b;
+    default:
+        // Alpha 255 maps to 256 so that b is reached exactly
+        return a + (((int16_t)b - a) * (alpha + (alpha >> 7)) >> 8);
+    }
+}
+
+void RGBLed::blend(RGBLed *source, BlendMode mode, uint8_t alpha)
+{
+    RGBLED_LOCK_TICK();
+    _blend_source = source;
+    _blend_mode = mode;
+    _blend_alpha = alpha;
+    show();
+    RGBLED_UNLOCK_TICK();
+}
+
+// Write one channel, skipping the hardware when the duty is unchanged
+void RGBLed::writeChannel(uint8_t channel, uint8_t duty)
+{
+    if (_duty_valid && _duty[channel] == duty)
+    {
+        _writes_skipped++;
+        return;
+    }
+
+    _duty[channel] = duty;
+    _writes_issued++;
+    RGBLED_STAT(_stats.writes++);
+
+#ifdef USE_I2C_PWM
+    if (_connection_type == I2C_PWM_CONNECTION)
+    {
+        // 8-bit duty to 12-bit, 255 maps to 4095
+        uint8_t channels[3] = {_red_channel, _green_channel, _blue_channel};
+        writePWM(channels[channel], ((uint16_t)duty << 4) | (duty >> 4), true);
+        return;
+    }
+#endif
+
 #if defined(ESP32)
-        ledcWrite(0, red);
-        ledcWrite(1, green);
-        ledcWrite(2, blue);
+    writePWM(channel, duty, false);
 #else
-        analogWrite(_red_pin, red);
-        analogWrite(_green_pin, green);
-        analogWrite(_blue_pin, blue);
+    writePWM(channel == 0 ? _red_pin : (channel == 1 ? _green_pin : _blue_pin), duty, false);
 #endif
+}
+
+// Write a pin (LEDC channel on ESP32), or stage a PCA9685 channel
+void RGBLed::writePWM(uint8_t channel_or_pin, uint16_t value, bool is_channel)
+{
+#ifdef USE_I2C_PWM
+    if (is_channel)
+    {
+        _pwm_driver->setChannel(channel_or_pin, value);
+        return;
     }
+#else
+    (void)is_channel;
+#endif
+
+#if defined(ESP32)
+    ledcWrite(channel_or_pin, value);
+#else
+    analogWrite(channel_or_pin, value);
+#endif
+}
+
+// Send staged PCA9685 channels, unless the application flushes once per tick
+void RGBLed::flushPWM(bool force)
+{
+#ifdef USE_I2C_PWM
+    if (_connection_type == I2C_PWM_CONNECTION && (force || _pwm_driver->autoFlush()))
+        _pwm_driver->flush();
+#else
+    (void)force;
+#endif
 }
 
 void RGBLed::setColor(int rgb[3])
 {
-    intensity(rgb[0], rgb[1], rgb[2], _brightness);
+    intensity(rgb[0], rgb[1], rgb[2]);
 }
 
 void RGBLed::setColor(int red, int green, int blue)
 {
-	intensity(red, green, blue, _brightness);
+	intensity(red, green, blue);
+}
+
+void RGBLed::setColorHSV(int hue, int saturation, int value)
+{
+	hsvIntensity(constrain(hue, 0, 255) * 6, constrain(saturation, 0, 255), constrain(value, 0, 255));
+}
+
+
+void RGBLed::flash(int rgb[3], int duration)
+{
+	flash(rgb[0], rgb[1], rgb[2], duration, duration);
+}
+
+void RGBLed::flash(int rgb[3], int onDuration, int duration)
+{
+	flash(rgb[0], rgb[1], rgb[2], onDuration, duration);
 }
 
+void RGBLed::flash(int red, int green, int blue, int duration)
+{
+	flash(red, green, blue, duration, duration);
+}
+
+void RGBLed::flash(int red, int green, int blue, int onDuration, int duration)
+{
+	flashAsync(red, green, blue, onDuration, duration);
+	runTransient();
+}
 
 void RGBLed::fadeOut(int rgb[3], int steps, int duration)
 {
-	fade(rgb[0], rgb[1], rgb[2], steps, duration, true);
+	fadeOut(rgb[0], rgb[1], rgb[2], steps, duration);
 }
 
+// steps is kept for compatibility, the ramp is now continuous
 void RGBLed::fadeOut(int red, int green, int blue, int steps, int duration)
 {
-	fade(red, green, blue, steps, duration, true);
+	(void)steps;
+	fadeOutAsync(red, green, blue, duration);
+	runTransient();
 }
 
 void RGBLed::fadeIn(int rgb[3], int steps, int duration)
 {
-	fade(rgb[0], rgb[1], rgb[2], steps, duration, false);
+	fadeIn(rgb[0], rgb[1], rgb[2], steps, duration);
 }
 
+// steps is kept for compatibility, the ramp is now continuous
 void RGBLed::fadeIn(int red, int green, int blue, int steps, int duration)
 {
-	fade(red, green, blue, steps, duration, false);
+	(void)steps;
+	fadeInAsync(red, green, blue, duration);
+	runTransient();
 }
 
-void RGBLed::fade(int red, int green, int blue, int steps, int duration, bool out)
+void RGBLed::crossFade(int rgbFrom[3], int rgbTo[3], int steps, int duration)
 {
-	if (duration < 0)
-		duration = 0;
-	if (steps < 1)
-		steps = 1;
+	crossFade(rgbFrom[0], rgbFrom[1], rgbFrom[2], rgbTo[0], rgbTo[1], rgbTo[2], steps, duration);
+}
 
-	if (out)
-	{
-		for (int i = steps; i >= 0; i--)
-		{
-			fade(red, green, blue, steps, duration, i * 255 / steps, i > 0);
-		}
-	}
-	else
-	{
-		for (int i = 0; i <= steps; i++)
-		{
-			fade(red, green, blue, steps, duration, i * 255 / steps, i < steps);
-		}
-	}
+// steps is kept for compatibility, the ramp is now continuous
+void RGBLed::crossFade(int fromRed, int fromGreen, int fromBlue, int toRed, int toGreen, int toBlue, int steps, int duration)
+{
+	(void)steps;
+	crossFadeAsync(fromRed, fromGreen, fromBlue, toRed, toGreen, toBlue, duration);
+	runTransient();
 }
 
-void RGBLed::fade(int red, int green, int blue, int steps, int duration, int value, bool wait)
+void RGBLed::flashAsync(int rgb[3], int duration)
 {
-	float brightness = float(value) / 255.f;
+	flashAsync(rgb[0], rgb[1], rgb[2], duration, duration);
+}
 
-	intensity(red * brightness, green * brightness, blue * brightness, _brightness);
+void RGBLed::flashAsync(int rgb[3], int onDuration, int duration)
+{
+	flashAsync(rgb[0], rgb[1], rgb[2], onDuration, duration);
+}
 
-	if (wait)
-	{
-		delay((unsigned long)(duration / steps));
-	}
+void RGBLed::flashAsync(int red, int green, int blue, int duration)
+{
+	flashAsync(red, green, blue, duration, duration);
 }
 
-void RGBLed::crossFade(int rgbFrom[3], int rgbTo[3], int steps, int duration)
+// On for onDuration, then off for duration, once
+void RGBLed::flashAsync(int red, int green, int blue, int onDuration, int duration)
 {
-	crossFade(rgbFrom[0], rgbFrom[1], rgbFrom[2], rgbTo[0], rgbTo[1], rgbTo[2], steps, duration);
+	startTransient(createBlinkPattern(constrain(red, 0, 255), constrain(green, 0, 255), constrain(blue, 0, 255),
+									  onDuration < 0 ? 0 : onDuration, duration < 0 ? 0 : duration,
+									  1, false));
 }
 
-void RGBLed::crossFade(int fromRed, int fromGreen, int fromBlue, int toRed, int toGreen, int toBlue, int steps, int duration)
+void RGBLed::fadeOutAsync(int rgb[3], int duration)
+{
+	fadeOutAsync(rgb[0], rgb[1], rgb[2], duration);
+}
+
+void RGBLed::fadeOutAsync(int red, int green, int blue, int duration)
+{
+	crossFadeAsync(red, green, blue, 0, 0, 0, duration);
+}
+
+void RGBLed::fadeInAsync(int rgb[3], int duration)
+{
+	fadeInAsync(rgb[0], rgb[1], rgb[2], duration);
+}
+
+void RGBLed::fadeInAsync(int red, int green, int blue, int duration)
+{
+	crossFadeAsync(0, 0, 0, red, green, blue, duration);
+}
+
+void RGBLed::crossFadeAsync(int rgbFrom[3], int rgbTo[3], int duration)
+{
+	crossFadeAsync(rgbFrom[0], rgbFrom[1], rgbFrom[2], rgbTo[0], rgbTo[1], rgbTo[2], duration);
+}
+
+void RGBLed::crossFadeAsync(int fromRed, int fromGreen, int fromBlue, int toRed, int toGreen, int toBlue, int duration)
+{
+	startTransient(createFadePattern(constrain(fromRed, 0, 255), constrain(fromGreen, 0, 255), constrain(fromBlue, 0, 255),
+									 constrain(toRed, 0, 255), constrain(toGreen, 0, 255), constrain(toBlue, 0, 255),
+									 duration < 0 ? 0 : duration, 0, false));
+}
+
+// Run a transient pattern above the current one, which is suspended as a
+// layer and resumes when the transient completes. Without a free slot to
+// keep it, or over another transient, the current pattern is replaced.
+// False when no slot is left, the current pattern then runs on.
+bool RGBLed::startTransient(const Pattern &pattern)
+{
+	unsigned long now = millis();
+	bool started;
+
+	RGBLED_LOCK_TICK();
+	uint8_t priority = _priority;
+	bool suspended = _slot != NO_SLOT && !_transient && _free_count >= 2;
+	if (suspended)
+		suspendLayer(now);
+	started = loadPattern(&pattern, now);
+	if (started)
+	{
+		_transient = true;
+		_priority = priority;
+	}
+	else if (suspended)
+	{
+		resumeLayer(now);
+	}
+	RGBLED_UNLOCK_TICK();
+	updatePattern(now);
+	return started;
+}
+
+// Blocking wrapper: drive the transient pattern until its own slot completes,
+// the pattern it suspended goes on running afterwards. Sleeps until the
+// output next changes instead of polling, a TickSource renders by itself.
+void RGBLed::runTransient()
 {
-	// Determine per color change
-	//   toValue - fromValue = deltaValue
-	int deltaRed = toRed - fromRed;
-	int deltaGreen = toGreen - fromGreen;
-	int deltaBlue = toBlue - fromBlue;
-
-	// Determine change per step per color
-	//   deltaValue / steps
-	//   Note: Forcing casting to floats to ensure smooth fades
-	//         with large number of steps
-	float changeRed = (float) deltaRed / (float) steps;
-	float changeGreen = (float) deltaGreen / (float) steps;
-	float changeBlue = (float) deltaBlue / (float) steps;
-
-	// run through steps
-	for (int i = 0; i <= steps; i++)
+	uint8_t slot = _slot;
+
+	// Not started (no slot left): do not wait on the pattern that runs on
+	if (!_transient)
+		return;
+
+	while (_slot == slot && _pattern_active)
 	{
-		// Determine the new value for each color based on the step
-		//  stepValue = fromValue + (changeValue * stepNumber)
-		int stepRed = fromRed + (changeRed * i);
-		int stepGreen = fromGreen + (changeGreen * i);
-		int stepBlue = fromBlue + (changeBlue * i);
-
-		// Make step change in color
-		intensity(stepRed, stepGreen, stepBlue, _brightness);
-
-		// delay based on total duration requested and number of steps
-		if (i < steps)
-		{
-			delay((unsigned long)(duration / steps));
-		}
+		unsigned long next = updatePattern(millis());
+		if (_slot != slot || !_pattern_active)
+			break;
+		if (next != 0)
+			delay(next == NO_DEADLINE ? 1 : next);
 	}
 }
 
@@ -229,362 +551,1284 @@ void RGBLed::gradient(int rgbFrom[3], int rgbTo[3], int step)
 
 void RGBLed::gradient(int fromRed, int fromGreen, int fromBlue, int toRed, int toGreen, int toBlue, int step)
 {
-	// Determine per color change
-	//   toValue - fromValue = deltaValue
-	int deltaRed = toRed - fromRed;
-	int deltaGreen = toGreen - fromGreen;
-	int deltaBlue = toBlue - fromBlue;
-
-	// Determine change per step per color
-	//   deltaValue / steps
-	//   Note: Forcing casting to floats to ensure smooth fades
-	//         with large number of steps
-	float changeRed = (float) deltaRed / (float)255;
-	float changeGreen = (float) deltaGreen / (float) 255;
-	float changeBlue = (float) deltaBlue / (float) 255;
-
-	
+	// Step 0..255 maps onto the full Q16 range (255 * 257 = 0xFFFF)
+	uint16_t progress = constrain(step, 0, 255) * 257U;
+
 	// Determine the new value for each color based on the step
-	//  stepValue = fromValue + (changeValue * stepNumber)
-	int stepRed = fromRed + (changeRed * step);
-	int stepGreen = fromGreen + (changeGreen * step);
-	int stepBlue = fromBlue + (changeBlue * step);
+	//  stepValue = fromValue + (toValue - fromValue) * step / 255
+	int stepRed = lerp8(constrain(fromRed, 0, 255), constrain(toRed, 0, 255), progress);
+	int stepGreen = lerp8(constrain(fromGreen, 0, 255), constrain(toGreen, 0, 255), progress);
+	int stepBlue = lerp8(constrain(fromBlue, 0, 255), constrain(toBlue, 0, 255), progress);
 
 	// Make step change in color
-	intensity(stepRed, stepGreen, stepBlue, _brightness);
+	intensity(stepRed, stepGreen, stepBlue);
 }
 
-// Initialize pattern state
-void RGBLed::callPattern(Pattern *pattern)
+// Q16 progress of elapsed over duration: 0 = start, 0xFFFF = end
+// Eased progress: two table reads and one multiply, whatever the curve
+uint16_t RGBLed::ease(uint8_t curve, uint16_t progress)
 {
-    _current_pattern = pattern;
-    _pattern_active = true;
-    _pattern_start_time = millis();
-    _last_update_time = millis();
-    _pattern_state = 0;
-    _blink_count = 0;
-    _fade_progress = 0.0f;
-    _fade_direction = true;
-}
+    if (curve == EASE_LINEAR || curve > EASE_SINE)
+        return progress;
 
-// Stop the current pattern
-void RGBLed::stopPattern()
-{
-    _pattern_active = false;
-    _current_pattern = nullptr;
-    off();
+    const uint16_t *table = EASE_TABLE[curve - 1];
+    uint8_t i = progress >> 12;
+    uint16_t a = pgm_read_word(&table[i]);
+    uint16_t b = pgm_read_word(&table[i + 1]);
+    return a + (int16_t)(((int32_t)b - a) * (progress & 0x0FFF) >> 12);
 }
 
-// Check if pattern is running
-bool RGBLed::isPatternActive()
+uint16_t RGBLed::progress16(unsigned long elapsed, unsigned long duration)
 {
-    return _pattern_active;
+    if (elapsed >= duration)
+        return 0xFFFF;
+
+    // Scale both down until the 16-bit shift below cannot overflow
+    while (duration > 0xFFFFUL)
+    {
+        duration >>= 1;
+        elapsed >>= 1;
+    }
+
+    unsigned long progress = (elapsed << 16) / duration;
+    return progress > 0xFFFF ? 0xFFFF : (uint16_t)progress;
 }
 
-// Main update function - call this in loop()
-void RGBLed::updatePattern(unsigned long now)
+// The divide of progress16(), once per ramp. Rounded up, so a product is
+// never below the exact progress.
+RGBLed::RampRate RGBLed::rampRate(unsigned long duration)
 {
-    if (!_pattern_active || _current_pattern == nullptr)
-        return;
+    RampRate rate;
 
-    switch (_current_pattern->type)
+    rate.shift = 0;
+    while (duration > 0xFFFFUL)
     {
-    case PATTERN_STATIC:
-        executeStaticPattern(now);
-        break;
-    case PATTERN_FADE:
-        executeFadePattern(now);
-        break;
-    case PATTERN_BLINK:
-        executeBlinkPattern(now);
-        break;
-    case PATTERN_CROSSFADE:
-        executeCrossfadePattern(now);
-        break;
+        duration >>= 1;
+        rate.shift++;
     }
+    rate.duration = duration;
+    // 1 only has elapsed 0, where any step gives 0
+    rate.step = duration > 1 ? 0xFFFFFFFFUL / duration + 1 : 0;
+    return rate;
 }
 
-// Execute static color pattern
-void RGBLed::executeStaticPattern(unsigned long now)
+// Same result as the divide: elapsed * step >> 16 in two 16x16 multiplies
+// overshoots by one at most, which one multiply by the duration detects
+uint16_t RGBLed::progress16(unsigned long elapsed, const RampRate &rate)
 {
-    StaticPattern *p = &_current_pattern->static_pattern;
-    
-    unsigned long elapsed = now - _pattern_start_time;
-    
-    if (_pattern_state == 0)
-    {
-        // Set the color
-        intensity(p->r, p->g, p->b, _brightness);
-        _pattern_state = 1;
-    }
-    
-    if (elapsed >= p->duration)
-    {
-        if (_current_pattern->repeat)
-        {
-            // Restart pattern
-            _pattern_start_time = now;
-            _pattern_state = 0;
-        }
-        else
-        {
-            // Pattern complete
-            stopPattern();
-        }
-    }
+    elapsed >>= rate.shift;
+    if (elapsed >= rate.duration)
+        return 0xFFFF;
+
+    uint16_t e = elapsed;
+    unsigned long progress = (unsigned long)e * (uint16_t)(rate.step >> 16) +
+                             (((unsigned long)e * (uint16_t)rate.step) >> 16);
+    if (progress * rate.duration > (elapsed << 16))
+        progress--;
+    return progress > 0xFFFF ? 0xFFFF : (uint16_t)progress;
 }
 
-// Execute fade pattern
-void RGBLed::executeFadePattern(unsigned long now)
+// Integer lerp: from + (to - from) * progress / 65536, rounded to nearest
+uint8_t RGBLed::lerp8(uint8_t from, uint8_t to, uint16_t progress)
 {
-    FadePattern *p = &_current_pattern->fade_pattern;
-    unsigned long elapsed = now - _pattern_start_time;
-    
-    if (_pattern_state == 0)
-    {
-        // Fading in
-        if (elapsed < p->time_on)
-        {
-            float progress = (float)elapsed / (float)p->time_on;
-            
-            uint8_t r = p->r_start + (p->r_end - p->r_start) * progress;
-            uint8_t g = p->g_start + (p->g_end - p->g_start) * progress;
-            uint8_t b = p->b_start + (p->b_end - p->b_start) * progress;
-            
-            intensity(r, g, b, _brightness);
-        }
-        else
-        {
-            // Fade complete, turn off
-            intensity(p->r_end, p->g_end, p->b_end, _brightness);
-            _pattern_state = 1;
-            _last_update_time = now;
-        }
-    }
-    else if (_pattern_state == 1)
-    {
-        // Off time
-        if (now - _last_update_time >= p->time_off)
-        {
-            if (_current_pattern->repeat)
-            {
-                // Restart pattern
-                _pattern_start_time = now;
-                _pattern_state = 0;
-            }
-            else
-            {
-                off();
-                stopPattern();
-            }
-        }
-    }
+    // Biasing by from << 16 keeps the sum non-negative for descending ramps
+    int32_t delta = (int16_t)to - (int16_t)from;
+    return (uint8_t)((((uint32_t)from << 16) + (uint32_t)(delta * (int32_t)progress) + 0x8000UL) >> 16);
 }
 
-// Execute blink pattern
-void RGBLed::executeBlinkPattern(unsigned long now)
+// Integer HSV, hue in 1536 steps
+void RGBLed::hsvIntensity(uint16_t hue, uint8_t s, uint8_t v)
 {
-    BlinkPattern *p = &_current_pattern->blink_pattern;
-    unsigned long elapsed = now - _last_update_time;
-    
-    if (_pattern_state == 0)
-    {
-        // LED ON
-        intensity(p->r, p->g, p->b, _brightness);
-        
-        if (elapsed >= p->time_on)
-        {
-            _pattern_state = 1;
-            _last_update_time = now;
-        }
-    }
-    else if (_pattern_state == 1)
-    {
-        // LED OFF
-        off();
-        
-        if (elapsed >= p->time_off)
-        {
-            _blink_count++;
-            
-            // Check if we've completed the requested blinks
-            if (p->repeat_count > 0 && _blink_count >= p->repeat_count)
-            {
-                if (_current_pattern->repeat)
-                {
-                    // Restart entire pattern
-                    _blink_count = 0;
-                    _pattern_state = 0;
-                    _last_update_time = now;
-                }
-                else
-                {
-                    stopPattern();
-                }
-            }
-            else
-            {
-                _pattern_state = 0;
-                _last_update_time = now;
-            }
-        }
-    }
+    intensity(hsvChannel(hue, s, v, 0), hsvChannel(hue, s, v, 1), hsvChannel(hue, s, v, 2));
 }
 
-// Execute crossfade pattern
-void RGBLed::executeCrossfadePattern(unsigned long now)
+// Initialize pattern state
+void RGBLed::callPattern(const Pattern *pattern)
 {
-    CrossfadePattern *p = &_current_pattern->crossfade_pattern;
-    unsigned long elapsed = now - _last_update_time;
-    
-    if (_pattern_state == 0)
-    {
-        // Fading from start to end
-        if (elapsed < p->fade_duration)
-        {
-            float progress = (float)elapsed / (float)p->fade_duration;
-            
-            uint8_t r = p->r_from + (p->r_to - p->r_from) * progress;
-            uint8_t g = p->g_from + (p->g_to - p->g_from) * progress;
-            uint8_t b = p->b_from + (p->b_to - p->b_from) * progress;
-            
-            intensity(r, g, b, _brightness);
-        }
-        else
-        {
-            intensity(p->r_to, p->g_to, p->b_to, _brightness);
-            _pattern_state = 1;
-            _last_update_time = now;
-        }
-    }
-    else if (_pattern_state == 1)
+    RGBLED_LOCK_TICK();
+    replacePattern(pattern, millis());
+    RGBLED_UNLOCK_TICK();
+}
+
+void RGBLed::callPattern(const Pattern &pattern)
+{
+    callPattern(&pattern);
+}
+
+// Start as if called at epoch, leds sharing the epoch run in phase
+void RGBLed::callPattern(const Pattern *pattern, unsigned long epoch)
+{
+    RGBLED_LOCK_TICK();
+    unsigned long now = millis();
+    replacePattern(pattern, now);
+
+    // Unsigned: an epoch still to come is one within the lead, not anything
+    // over 2^31 ms old
+    unsigned long lead = epoch - now;
+    if (lead > 0 && lead <= EPOCH_LEAD)
     {
-        // Hold at end color
-        if (elapsed >= p->hold_duration)
-        {
-            if (p->reverse)
-            {
-                // Start reverse fade
-                _pattern_state = 2;
-                _last_update_time = now;
-            }
-            else if (_current_pattern->repeat)
-            {
-                // Restart pattern
-                _pattern_state = 0;
-                _last_update_time = now;
-            }
-            else
-            {
-                stopPattern();
-            }
-        }
+        // Dark until then, the wake gate skips the executor
+        off();
+        _pattern_start_time = epoch;
+        _pattern_pending = true;
+        _wake_from = now;
+        _wake_for = lead;
     }
-    else if (_pattern_state == 2)
+    else
     {
-        // Fading back from end to start
-        if (elapsed < p->fade_duration)
-        {
-            float progress = (float)elapsed / (float)p->fade_duration;
-            
-            uint8_t r = p->r_to + (p->r_from - p->r_to) * progress;
-            uint8_t g = p->g_to + (p->g_from - p->g_to) * progress;
-            uint8_t b = p->b_to + (p->b_from - p->b_to) * progress;
-            
-            intensity(r, g, b, _brightness);
-        }
-        else
-        {
-            intensity(p->r_from, p->g_from, p->b_from, _brightness);
-            _pattern_state = 3;
-            _last_update_time = now;
-        }
+        rewindPattern(now - epoch, now);
     }
-    else if (_pattern_state == 3)
+    RGBLED_UNLOCK_TICK();
+}
+
+void RGBLed::callPattern(const Pattern &pattern, unsigned long epoch)
+{
+    callPattern(&pattern, epoch);
+}
+
+// Start a pattern in place of the current one and every suspended layer
+void RGBLed::replacePattern(const Pattern *pattern, unsigned long now)
+{
+    dropLayers();
+    loadPattern(pattern, now);
+    _priority = 0;
+}
+
+// Copy a pattern into a free slot and start it, false (nothing changes)
+// when the pool is empty
+bool RGBLed::loadPattern(const Pattern *pattern, unsigned long now)
+{
+    uint8_t slot = acquireSlot();
+    if (slot == NO_SLOT)
+        return false;
+
+    _slots[slot] = *pattern;
+    startSlot(slot, now);
+    return true;
+}
+
+// Start the pattern held in a slot, the previous slot goes back to the pool.
+// The new slot is taken first, so the source may alias the current pattern.
+void RGBLed::startSlot(uint8_t slot, unsigned long now)
+{
+    releaseSlot(_slot);
+    _slot = slot;
+    _current_pattern = &_slots[slot];
+    _pattern_active = true;
+    _pattern_start_time = now;
+    _pattern_pending = false;
+    _wake_for = 0;
+    _transient = false;
+
+    compilePattern(_current_pattern, _program, _timeline);
+    startCursor(_cursor);
+}
+
+// Restart the current pattern as if it had run for elapsed ms at now, the
+// next update folds whole periods
+void RGBLed::rewindPattern(unsigned long elapsed, unsigned long now)
+{
+    _pattern_start_time = now - elapsed;
+    _pattern_pending = false;
+    _wake_for = 0;
+    startCursor(_cursor);
+}
+
+// Jump the running pattern to position ms from its start
+void RGBLed::seek(unsigned long position)
+{
+    RGBLED_LOCK_TICK();
+    if (_pattern_active && _current_pattern != nullptr)
+        rewindPattern(position, millis());
+    RGBLED_UNLOCK_TICK();
+}
+
+// What a pattern shows t ms after its start, on a timeline of its own
+PatternSample RGBLed::evaluate(const Pattern &pattern, unsigned long t)
+{
+    uint8_t code[PROGRAM_SIZE];
+    Timeline timeline;
+    Cursor cursor;
+
+    compilePattern(&pattern, code, timeline);
+    startCursor(cursor);
+    return sampleTimeline(timeline, cursor, t);
+}
+
+// The cursor is kept from one time to the next, it only walks back when a
+// time is earlier than the previous one
+void RGBLed::evaluate(const Pattern &pattern, const unsigned long *t, PatternSample *samples, uint8_t count)
+{
+    uint8_t code[PROGRAM_SIZE];
+    Timeline timeline;
+    Cursor cursor;
+
+    compilePattern(&pattern, code, timeline);
+    startCursor(cursor);
+    for (uint8_t i = 0; i < count; i++)
+        samples[i] = sampleTimeline(timeline, cursor, t[i]);
+}
+
+// Copy a PROGMEM pattern into a slot, ticks then read RAM
+void RGBLed::callPattern_P(const Pattern *pattern)
+{
+    RGBLED_LOCK_TICK();
+    dropLayers();
+    uint8_t slot = acquireSlot();
+    if (slot != NO_SLOT)
     {
-        // Hold at start color
-        if (elapsed >= p->hold_duration)
+        memcpy_P(&_slots[slot], pattern, sizeof(Pattern));
+        startSlot(slot, millis());
+        _priority = 0;
+    }
+    RGBLED_UNLOCK_TICK();
+}
+
+void RGBLed::callPattern(const PackedPattern *pattern)
+{
+    Pattern unpacked = unpackPattern(*pattern);
+
+    RGBLED_LOCK_TICK();
+    replacePattern(&unpacked, millis());
+    RGBLED_UNLOCK_TICK();
+}
+
+void RGBLed::callPattern_P(const PackedPattern *pattern)
+{
+    PackedPattern packed;
+    memcpy_P(&packed, pattern, sizeof(PackedPattern));
+    callPattern(&packed);
+}
+
+#if RGBLED_COMMAND_SLOTS > 0
+bool RGBLed::postPattern(const Pattern *pattern)
+{
+    return postCommand(COMMAND_PATTERN, pattern, 0);
+}
+
+bool RGBLed::postStop()
+{
+    return postCommand(COMMAND_STOP, nullptr, 0);
+}
+
+bool RGBLed::postBrightness(int brightness)
+{
+    return postCommand(COMMAND_BRIGHTNESS, nullptr, brightness);
+}
+
+// Producer side: fill the slot, then publish it by moving the head. The
+// counters run freely, head - tail requests are queued, so every slot is
+// used. The pattern is copied, so an ISR can post a local.
+bool RGBLed::postCommand(uint8_t type, const Pattern *pattern, int brightness)
+{
+    uint8_t head = _command_head;
+
+    if ((uint8_t)(head - _command_tail) >= RGBLED_COMMAND_SLOTS)
+        return false;
+
+    Command *command = &_commands[head & (RGBLED_COMMAND_SLOTS - 1)];
+    command->type = type;
+    if (pattern != nullptr)
+        command->pattern = *pattern;
+    command->brightness = brightness;
+    RGBLED_BARRIER();
+    _command_head = head + 1;
+    return true;
+}
+
+// Consumer side, runs at the start of every update
+void RGBLed::drainCommands(unsigned long now)
+{
+    uint8_t tail = _command_tail;
+
+    while (tail != _command_head)
+    {
+        RGBLED_BARRIER();
+        const Command *command = &_commands[tail & (RGBLED_COMMAND_SLOTS - 1)];
+
+        switch (command->type)
+        {
+        case COMMAND_PATTERN:
+            replacePattern(&command->pattern, now);
+            break;
+        case COMMAND_STOP:
+            clearPattern();
+            break;
+        case COMMAND_BRIGHTNESS:
+            _scale = brightnessScale(command->brightness);
+            show();
+            break;
+        }
+
+        RGBLED_BARRIER();
+        _command_tail = ++tail;
+    }
+}
+#endif
+
+// Stop the current pattern
+void RGBLed::stopPattern()
+{
+    RGBLED_LOCK_TICK();
+    clearPattern();
+    RGBLED_UNLOCK_TICK();
+}
+
+// Drop the current pattern and give its slot back, the output is left as is
+void RGBLed::releasePattern()
+{
+    _pattern_active = false;
+    _current_pattern = nullptr;
+    releaseSlot(_slot);
+    _slot = NO_SLOT;
+    _priority = 0;
+}
+
+// Drop every layer and turn the led off
+void RGBLed::clearPattern()
+{
+    dropLayers();
+    releasePattern();
+    off();
+}
+
+// Give the slots of every suspended pattern back, the current one runs on
+void RGBLed::dropLayers()
+{
+    while (_layer_count > 0)
+        releaseSlot(_layers[--_layer_count].slot);
+}
+
+// End of a non-repeating pattern: the layer below resumes, otherwise
+// transients keep their last color. Returns the executor's deadline.
+unsigned long RGBLed::completePattern(unsigned long now)
+{
+    RGBLED_STAT(_stats.completions++);
+
+    if (_layer_count > 0)
+    {
+        releasePattern();
+        resumeLayer(now);
+        return 0;
+    }
+
+    if (_transient)
+    {
+        releasePattern();
+        _transient = false;
+    }
+    else
+    {
+        clearPattern();
+    }
+    return NO_DEADLINE;
+}
+
+bool RGBLed::pushPattern(const Pattern *pattern, uint8_t priority)
+{
+    bool pushed = true;
+    unsigned long now = millis();
+
+    RGBLED_LOCK_TICK();
+    if (_slot == NO_SLOT)
+    {
+        pushed = loadPattern(pattern, now);
+        if (pushed)
+            _priority = priority;
+    }
+    else if (_free_count < 2)
+    {
+        pushed = false;
+    }
+    else
+    {
+        uint8_t slot = acquireSlot();
+        _slots[slot] = *pattern;
+
+        if (priority >= _priority)
+        {
+            suspendLayer(now);
+            startSlot(slot, now);
+            _priority = priority;
+        }
+        else
         {
-            if (_current_pattern->repeat)
+            insertLayer(slot, priority, now);
+        }
+    }
+    RGBLED_UNLOCK_TICK();
+    return pushed;
+}
+
+bool RGBLed::pushPattern(const Pattern &pattern, uint8_t priority)
+{
+    return pushPattern(&pattern, priority);
+}
+
+// End the current pattern now, the layer below resumes
+void RGBLed::popPattern()
+{
+    RGBLED_LOCK_TICK();
+    if (_layer_count > 0)
+    {
+        releasePattern();
+        resumeLayer(millis());
+    }
+    else
+    {
+        clearPattern();
+    }
+    RGBLED_UNLOCK_TICK();
+}
+
+// Save the running pattern on top of the stack, its slot stays held
+void RGBLed::suspendLayer(unsigned long now)
+{
+    Layer *layer = &_layers[_layer_count++];
+
+    layer->slot = _slot;
+    layer->priority = _priority;
+    memcpy(layer->shown, _shown, 3);
+    layer->transient = _transient;
+    layer->start_time = _pattern_start_time;
+    layer->pending = _pattern_pending;
+    layer->head = _timeline.head;
+    layer->period = _timeline.period;
+    layer->stalls = _timeline.stalls;
+    layer->cursor = _cursor;
+    layer->suspended_at = now;
+
+    _slot = NO_SLOT;
+}
+
+// Queue a lower priority pattern below the running one, it starts when
+// reached. Its period is found now, as for any pattern that starts.
+void RGBLed::insertLayer(uint8_t slot, uint8_t priority, unsigned long now)
+{
+    uint8_t code[PROGRAM_SIZE];
+    Timeline timeline;
+    uint8_t i = _layer_count++;
+
+    compilePattern(&_slots[slot], code, timeline);
+
+    while (i > 0 && i < MAX_LAYERS && _layers[i - 1].priority > priority)
+    {
+        _layers[i] = _layers[i - 1];
+        i--;
+    }
+
+    Layer *layer = &_layers[i];
+    memset(layer, 0, sizeof(Layer));
+    layer->slot = slot;
+    layer->priority = priority;
+    layer->start_time = now;
+    layer->suspended_at = now;
+    layer->head = timeline.head;
+    layer->period = timeline.period;
+    layer->stalls = timeline.stalls;
+    startCursor(layer->cursor);
+}
+
+// Restore the top of the stack, shifted by the time it spent suspended.
+// The bytecode is emitted again (a few bytes), the period and the cursor
+// are restored as saved: no walk, whatever the pattern.
+void RGBLed::resumeLayer(unsigned long now)
+{
+    const Layer *layer = &_layers[--_layer_count];
+    unsigned long shift = now - layer->suspended_at;
+
+    _slot = layer->slot;
+    _current_pattern = &_slots[_slot];
+    emitPattern(_current_pattern, _program, _timeline);
+    _timeline.head = layer->head;
+    _timeline.period = layer->period;
+    _timeline.stalls = layer->stalls;
+    _cursor = layer->cursor;
+
+    _priority = layer->priority;
+    _transient = layer->transient;
+    _pattern_start_time = layer->start_time + shift;
+    _pattern_pending = layer->pending;
+    _wake_for = 0;
+    _pattern_active = true;
+
+    intensity(layer->shown[0], layer->shown[1], layer->shown[2]);
+}
+
+// Every slot starts free, nothing shown yet
+void RGBLed::initSlots()
+{
+    for (uint8_t i = 0; i < RGBLED_PATTERN_SLOTS; i++)
+        _free_slots[i] = i;
+    _free_count = RGBLED_PATTERN_SLOTS;
+    _shown[0] = _shown[1] = _shown[2] = 0;
+    _output[0] = _output[1] = _output[2] = 0;
+}
+
+// Only the current pattern holds a slot, so a free one is always left
+uint8_t RGBLed::acquireSlot()
+{
+    // Cannot happen while the layers leave a slot free, but a corrupt count
+    // must not index below the stack
+    if (_free_count == 0)
+        return NO_SLOT;
+    return _free_slots[--_free_count];
+}
+
+void RGBLed::releaseSlot(uint8_t slot)
+{
+    if (slot != NO_SLOT)
+        _free_slots[_free_count++] = slot;
+}
+
+unsigned long RGBLed::writesIssued()
+{
+    return _writes_issued;
+}
+
+unsigned long RGBLed::writesSkipped()
+{
+    return _writes_skipped;
+}
+
+void RGBLed::resetWriteCounters()
+{
+    _writes_issued = 0;
+    _writes_skipped = 0;
+}
+
+#ifdef RGBLED_STATS
+const RGBLedStats &RGBLed::stats()
+{
+    return _stats;
+}
+
+void RGBLed::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+// Dump the counters, one per line
+void RGBLed::printStats(Print &out)
+{
+    out.print("updates: ");
+    out.println(_stats.updates);
+    out.print("writes: ");
+    out.println(_stats.writes);
+    out.print("completions: ");
+    out.println(_stats.completions);
+    out.print("repeats: ");
+    out.println(_stats.repeats);
+    out.print("skipped: ");
+    out.println(_stats.skipped);
+    printTiming(out, "program", _stats.program);
+    printTiming(out, "sequence", _stats.sequence);
+}
+
+void RGBLed::printTiming(Print &out, const char *name, const RGBLedTiming &timing)
+{
+    out.print(name);
+    out.print(": calls ");
+    out.print(timing.calls);
+    out.print(", avg ");
+    out.print(timing.calls ? timing.total / timing.calls : 0UL);
+    out.print(" us, max ");
+    out.print(timing.max);
+    out.println(" us");
+}
+
+void RGBLed::recordTiming(RGBLedTiming &timing, unsigned long start)
+{
+    unsigned long spent = micros() - start;
+    timing.calls++;
+    timing.total += spent;
+    if (spent > timing.max)
+        timing.max = spent;
+}
+#endif
+
+// Check if pattern is running
+bool RGBLed::isPatternActive()
+{
+    return _pattern_active;
+}
+
+const Pattern *RGBLed::currentPattern() const
+{
+    return _pattern_active ? _current_pattern : nullptr;
+}
+
+// Main update function - call this in loop()
+// Returns the time until the output next changes (ms), 0 to call again at
+// once, NO_DEADLINE when no pattern is running
+unsigned long RGBLed::updatePattern(unsigned long now)
+{
+    // Driven by a TickSource instead
+    if (_tick_source != nullptr)
+        return NO_DEADLINE;
+
+    return renderPattern(now);
+}
+
+unsigned long RGBLed::renderPattern(unsigned long now)
+{
+    RGBLED_STAT(_stats.updates++);
+
+#if RGBLED_COMMAND_SLOTS > 0
+    if (_command_tail != _command_head)
+        drainCommands(now);
+#endif
+
+    // Blend source first, so this led's writes use its new output
+    unsigned long source_next = NO_DEADLINE;
+    if (_blend_source != nullptr)
+        source_next = _blend_source->renderPattern(now);
+
+    unsigned long next = NO_DEADLINE;
+    unsigned long waited = now - _wake_from;
+    if (!_pattern_active || _current_pattern == nullptr)
+    {
+        // Nothing to run
+    }
+    else if (_wake_for == NO_DEADLINE || waited < _wake_for)
+    {
+        // The executor said when the output next changes, until then a
+        // tick costs this compare. A held color never wakes, only a new
+        // pattern, a seek or a resume re-arms the led.
+        next = _wake_for == NO_DEADLINE ? NO_DEADLINE : _wake_for - waited;
+        RGBLED_STAT(_stats.skipped++);
+    }
+    else
+    {
+        RGBLED_STAT(unsigned long start = micros());
+        RGBLED_STAT(bool sequence = _current_pattern->type == PATTERN_SEQUENCE);
+
+        next = executePattern(now);
+        RGBLED_STAT(recordTiming(sequence ? _stats.sequence : _stats.program, start));
+
+        _wake_from = now;
+        _wake_for = next;
+    }
+
+    // The source may have changed while this pattern holds its color
+    if (_blend_source != nullptr)
+    {
+        show();
+        if (source_next < next)
+            next = source_next;
+    }
+
+    // Output marked by show() for the tick source to write
+    if (_redraw)
+    {
+        _redraw = false;
+        writeOutput();
+    }
+    return next;
+}
+
+// Time until any channel of a ramp reaches its next 8-bit level (ms)
+unsigned long RGBLed::rampDeadline(const uint8_t from[3], const uint8_t to[3], unsigned long elapsed, unsigned long duration, const RampRate &rate)
+{
+    unsigned long next = duration;
+    uint16_t progress = progress16(elapsed, rate);
+
+    for (uint8_t c = 0; c < 3; c++)
+    {
+        uint8_t delta = from[c] < to[c] ? to[c] - from[c] : from[c] - to[c];
+        if (delta == 0)
+            continue;
+
+        uint8_t level = lerp8(from[c], to[c], progress);
+        uint8_t moved = level < from[c] ? from[c] - level : level - from[c];
+
+        // lerp8() rounds, so the next level starts half way past this one
+        unsigned long t = ((2UL * moved + 1) * duration + 2UL * delta - 1) / (2UL * delta);
+        if (t < next)
+            next = t;
+    }
+
+    return next > elapsed ? next - elapsed : 1;
+}
+
+// True when an eased ramp shows other levels at t than the given ones
+bool RGBLed::easedMoved(uint8_t curve, const uint8_t from[3], const uint8_t to[3], const uint8_t level[3], unsigned long t, const RampRate &rate)
+{
+    uint16_t progress = ease(curve, progress16(t, rate));
+
+    for (uint8_t c = 0; c < 3; c++)
+    {
+        if (lerp8(from[c], to[c], progress) != level[c])
+            return true;
+    }
+    return false;
+}
+
+// Time until an eased ramp reaches its next 8-bit level. The curves have no
+// inverse, so search it: double the step until a level moves, then bisect.
+// The curves are monotonic (EASE_SINE on each half), nothing is skipped.
+unsigned long RGBLed::easedDeadline(uint8_t curve, const uint8_t from[3], const uint8_t to[3], unsigned long elapsed, unsigned long duration, const RampRate &rate)
+{
+    uint16_t progress = ease(curve, progress16(elapsed, rate));
+    uint8_t level[3];
+    for (uint8_t c = 0; c < 3; c++)
+        level[c] = lerp8(from[c], to[c], progress);
+
+    unsigned long limit = duration;
+    if (curve == EASE_SINE && elapsed < duration / 2)
+        limit = duration / 2;
+
+    // The first change is after lo and no later than hi
+    unsigned long lo = elapsed, hi = limit, step = 1;
+    while (step < limit - lo)
+    {
+        if (easedMoved(curve, from, to, level, lo + step, rate))
+        {
+            hi = lo + step;
+            break;
+        }
+        lo += step;
+        step <<= 1;
+    }
+    while (hi - lo > 1)
+    {
+        unsigned long mid = lo + (hi - lo) / 2;
+        if (easedMoved(curve, from, to, level, mid, rate))
+            hi = mid;
+        else
+            lo = mid;
+    }
+
+    return hi > elapsed ? hi - elapsed : 1;
+}
+
+// Compile a pattern, then find where it repeats
+void RGBLed::compilePattern(const Pattern *pattern, uint8_t *code, Timeline &timeline)
+{
+    emitPattern(pattern, code, timeline);
+    findPeriod(timeline);
+}
+
+// Compile the basic pattern types to bytecode (code holds PROGRAM_SIZE
+// bytes), programs run in place. A few bytes per type, no walk.
+void RGBLed::emitPattern(const Pattern *pattern, uint8_t *code, Timeline &timeline)
+{
+    uint8_t n = 0;
+
+    timeline.pattern = pattern;
+    timeline.code = code;
+    timeline.progmem = false;
+
+    switch (pattern->type)
+    {
+    case PATTERN_STATIC:
+    {
+        const StaticPattern *p = &pattern->static_pattern;
+        code[n++] = OP_SET; code[n++] = p->r; code[n++] = p->g; code[n++] = p->b;
+        code[n++] = OP_WAIT; n = emitTime(code, n, p->duration);
+        break;
+    }
+    case PATTERN_FADE:
+    {
+        const FadePattern *p = &pattern->fade_pattern;
+        if (p->easing != EASE_LINEAR)
+        {
+            code[n++] = OP_EASE; code[n++] = p->easing;
+        }
+        code[n++] = OP_SET; code[n++] = p->r_start; code[n++] = p->g_start; code[n++] = p->b_start;
+        code[n++] = OP_RAMP; code[n++] = p->r_end; code[n++] = p->g_end; code[n++] = p->b_end;
+        n = emitTime(code, n, p->time_on);
+        code[n++] = OP_WAIT; n = emitTime(code, n, p->time_off);
+        break;
+    }
+    case PATTERN_BLINK:
+    {
+        const BlinkPattern *p = &pattern->blink_pattern;
+        code[n++] = OP_SET; code[n++] = p->r; code[n++] = p->g; code[n++] = p->b;
+        code[n++] = OP_WAIT; n = emitTime(code, n, p->time_on);
+        code[n++] = OP_SET; code[n++] = 0; code[n++] = 0; code[n++] = 0;
+        code[n++] = OP_WAIT; n = emitTime(code, n, p->time_off);
+        if (p->repeat_count > 1)
+        {
+            // repeat_count blinks, 0 blinks forever
+            code[n++] = OP_LOOP; code[n++] = p->repeat_count - 1; code[n++] = 0;
+        }
+        else if (p->repeat_count == 0)
+        {
+            code[n++] = OP_JUMP; code[n++] = 0;
+        }
+        break;
+    }
+    case PATTERN_CROSSFADE:
+    {
+        const CrossfadePattern *p = &pattern->crossfade_pattern;
+        if (p->easing != EASE_LINEAR)
+        {
+            code[n++] = OP_EASE; code[n++] = p->easing;
+        }
+        code[n++] = OP_SET; code[n++] = p->r_from; code[n++] = p->g_from; code[n++] = p->b_from;
+        code[n++] = OP_RAMP; code[n++] = p->r_to; code[n++] = p->g_to; code[n++] = p->b_to;
+        n = emitTime(code, n, p->fade_duration);
+        code[n++] = OP_WAIT; n = emitTime(code, n, p->hold_duration);
+        if (p->reverse)
+        {
+            // A breathing ramp returns to its start color, so it runs forward again
+            bool breathe = p->easing == EASE_SINE;
+            code[n++] = OP_RAMP; code[n++] = breathe ? p->r_to : p->r_from;
+            code[n++] = breathe ? p->g_to : p->g_from; code[n++] = breathe ? p->b_to : p->b_from;
+            n = emitTime(code, n, p->fade_duration);
+            code[n++] = OP_WAIT; n = emitTime(code, n, p->hold_duration);
+        }
+        break;
+    }
+    case PATTERN_HUE_CYCLE:
+    {
+        const HueCyclePattern *p = &pattern->hue_cycle_pattern;
+        code[n++] = OP_HUE; code[n++] = p->hue_from; code[n++] = p->hue_to;
+        code[n++] = p->saturation; code[n++] = p->value;
+        n = emitTime(code, n, p->duration);
+        break;
+    }
+    case PATTERN_PROGRAM:
+        timeline.code = pattern->program_pattern.code;
+        timeline.length = pattern->program_pattern.length;
+        timeline.progmem = pattern->program_pattern.progmem;
+        return;
+    default:
+        break;
+    }
+
+    if (n > 0)
+    {
+        if (pattern->repeat)
+        {
+            code[n++] = OP_JUMP; code[n++] = 0;
+        }
+        else
+        {
+            code[n++] = OP_END;
+        }
+    }
+    timeline.length = n;
+}
+
+// Append a time operand, the duration is kept exact
+uint8_t RGBLed::emitTime(uint8_t *code, uint8_t n, unsigned long ms)
+{
+    for (uint8_t i = 0; i < 4; i++, ms >>= 8)
+        code[n++] = ms & 0xFF;
+    return n;
+}
+
+// Start of a pattern: first instruction, nothing set yet
+void RGBLed::startCursor(Cursor &cursor)
+{
+    cursor.at = 0;
+    cursor.pc = 0;
+    cursor.loops = 0;
+    cursor.ease = EASE_LINEAR;
+    cursor.color[0] = cursor.color[1] = cursor.color[2] = 0;
+    cursor.rate_pc = NO_RATE;
+}
+
+// Reciprocal of the ramp at the cursor, taken when the cursor reaches it.
+// The code does not change, so it holds until the cursor moves on.
+const RGBLed::RampRate &RGBLed::cursorRate(Cursor &cursor, unsigned long duration)
+{
+    if (cursor.rate_pc != cursor.pc)
+    {
+        cursor.rate = rampRate(duration);
+        cursor.rate_pc = cursor.pc;
+    }
+    return cursor.rate;
+}
+
+// Find where a pattern starts to repeat. Programs are walked without output
+// and the state after each jump is kept: the same state twice means that
+// everything from the first one on repeats, whatever ran before it. Costs
+// the intro and up to two periods of instructions, once per start.
+void RGBLed::findPeriod(Timeline &timeline)
+{
+    Cursor cursor;
+    startCursor(cursor);
+    timeline.head = cursor;
+    timeline.period = 0;
+    timeline.stalls = false;
+
+    if (timeline.pattern->type == PATTERN_SEQUENCE)
+    {
+        const SequencePattern *p = &timeline.pattern->sequence_pattern;
+        Keyframe frame;
+
+        if (!timeline.pattern->repeat || p->count == 0)
+            return;
+        for (uint8_t i = 0; i < p->count; i++)
+        {
+            readKeyframe(p, i, &frame);
+            timeline.period += (unsigned long)frame.ramp + frame.hold;
+        }
+
+        // Keyframes without time: the last one holds
+        timeline.stalls = timeline.period == 0;
+        timeline.head.color[0] = frame.r;
+        timeline.head.color[1] = frame.g;
+        timeline.head.color[2] = frame.b;
+        return;
+    }
+
+    Cursor jumps[4]; // Latest states after a jump
+    uint8_t count = 0;
+
+    for (uint16_t steps = 0; steps < MAX_STEPS; steps++)
+    {
+        bool jump = fetch(timeline, cursor.pc) == OP_JUMP;
+        if (!stepProgram(timeline, cursor))
+            return;
+        if (!jump)
+            continue;
+
+        for (uint8_t i = 0; i < count && i < 4; i++)
+        {
+            const Cursor *seen = &jumps[i];
+            if (seen->pc == cursor.pc && seen->loops == cursor.loops && seen->ease == cursor.ease &&
+                memcmp(seen->color, cursor.color, 3) == 0)
             {
-                // Restart pattern
-                _pattern_state = 0;
-                _last_update_time = now;
+                timeline.head = *seen;
+                timeline.period = cursor.at - seen->at;
+                timeline.stalls = timeline.period == 0;
+                return;
             }
+        }
+        jumps[count++ & 3] = cursor;
+    }
+}
+
+// Show the current pattern at now. Whole periods move the start time
+// forward, so t stays within one period past the intro however long the
+// pattern runs or the loop stalls. Returns the time until the next change.
+unsigned long RGBLed::executePattern(unsigned long now)
+{
+    unsigned long t = now - _pattern_start_time;
+    unsigned long period = _timeline.period;
+
+    // Started ahead of its epoch: dark until the first update at or after
+    // it, also after a resume. Only then, the start time of a pattern that
+    // holds never moves and the difference wraps into the lead in 49 days.
+    if (_pattern_pending)
+    {
+        unsigned long lead = _pattern_start_time - now;
+        if (lead > 0 && lead <= EPOCH_LEAD)
+        {
+            intensity(0, 0, 0);
+            return lead;
+        }
+        _pattern_pending = false;
+    }
+
+    if (period > 0 && t >= _timeline.head.at + period)
+    {
+        unsigned long skip = t - _timeline.head.at;
+        skip -= skip % period;
+        _pattern_start_time += skip;
+        t -= skip;
+        RGBLED_STAT(_stats.repeats += skip / period);
+    }
+
+    PatternSample sample = sampleTimeline(_timeline, _cursor, t);
+    intensity(sample.rgb[0], sample.rgb[1], sample.rgb[2]);
+
+    if (!sample.active)
+        return completePattern(now);
+    return sample.next;
+}
+
+// What a timeline shows t ms after its start. The cursor only caches the
+// walk: it moves forward with t, and back to the head or the start when t
+// is behind it.
+PatternSample RGBLed::sampleTimeline(const Timeline &timeline, Cursor &cursor, unsigned long t)
+{
+    PatternSample sample;
+
+    if (timeline.period > 0 && t >= timeline.head.at + timeline.period)
+        t = timeline.head.at + (t - timeline.head.at) % timeline.period;
+
+    sample.phase = t;
+    sample.active = true;
+
+    if (t < cursor.at)
+    {
+        if (t >= timeline.head.at)
+            cursor = timeline.head;
+        else
+            startCursor(cursor);
+    }
+
+    if (timeline.stalls && t >= timeline.head.at)
+    {
+        memcpy(sample.rgb, timeline.head.color, 3);
+        sample.next = NO_DEADLINE;
+    }
+    else if (timeline.pattern->type == PATTERN_SEQUENCE)
+    {
+        sampleSequence(timeline, cursor, t, sample);
+    }
+    else
+    {
+        sampleProgram(timeline, cursor, t, sample);
+    }
+    return sample;
+}
+
+// Walk to the instruction running at t, then interpolate it
+void RGBLed::sampleProgram(const Timeline &timeline, Cursor &cursor, unsigned long t, PatternSample &sample)
+{
+    for (uint16_t steps = 0; steps < MAX_STEPS; steps++)
+    {
+        uint8_t pc = cursor.pc;
+        unsigned long elapsed = t - cursor.at;
+
+        switch (fetch(timeline, pc))
+        {
+        case OP_RAMP:
+        {
+            unsigned long duration = fetchTime(timeline, pc + 4);
+            if (elapsed >= duration)
+                break;
+
+            uint8_t target[3] = {fetch(timeline, pc + 1), fetch(timeline, pc + 2), fetch(timeline, pc + 3)};
+            const RampRate &rate = cursorRate(cursor, duration);
+            uint16_t progress = ease(cursor.ease, progress16(elapsed, rate));
+            for (uint8_t c = 0; c < 3; c++)
+                sample.rgb[c] = lerp8(cursor.color[c], target[c], progress);
+
+            if (cursor.ease != EASE_LINEAR)
+                sample.next = easedDeadline(cursor.ease, cursor.color, target, elapsed, duration, rate);
             else
-            {
-                stopPattern();
-            }
+                sample.next = rampDeadline(cursor.color, target, elapsed, duration, rate);
+            return;
+        }
+
+        case OP_WAIT:
+        {
+            unsigned long duration = fetchTime(timeline, pc + 1);
+            if (elapsed >= duration)
+                break;
+
+            memcpy(sample.rgb, cursor.color, 3);
+            sample.next = duration - elapsed;
+            return;
+        }
+
+        case OP_HUE:
+        {
+            unsigned long duration = fetchTime(timeline, pc + 5);
+            if (elapsed >= duration)
+                break;
+
+            uint8_t from = fetch(timeline, pc + 1), s = fetch(timeline, pc + 3), v = fetch(timeline, pc + 4);
+            uint16_t span = (uint8_t)(fetch(timeline, pc + 2) - from) * 6;
+            if (span == 0)
+                span = 1536; // Full turn
+
+            // One hue step per span-th of the duration
+            uint16_t offset = ((uint32_t)span * progress16(elapsed, cursorRate(cursor, duration))) >> 16;
+            uint16_t hue = from * 6 + offset;
+            if (hue >= 1536)
+                hue -= 1536;
+            for (uint8_t c = 0; c < 3; c++)
+                sample.rgb[c] = hsvChannel(hue, s, v, c);
+
+            unsigned long at = ((unsigned long)(offset + 1) * duration + span - 1) / span;
+            sample.next = at > elapsed ? at - elapsed : 1;
+            return;
+        }
+        }
+
+        // Untimed, or over by t
+        if (!stepProgram(timeline, cursor))
+        {
+            memcpy(sample.rgb, cursor.color, 3);
+            sample.next = NO_DEADLINE;
+            sample.active = false;
+            return;
+        }
+    }
+
+    // Still walking (a long loop without time), go on at the next update
+    memcpy(sample.rgb, cursor.color, 3);
+    sample.next = 0;
+}
+
+// Execute the instruction at the cursor as if its time had passed. Timed
+// instructions advance the cursor by their exact duration, so a late update
+// does not shift what follows. False at OP_END or past the end.
+bool RGBLed::stepProgram(const Timeline &timeline, Cursor &cursor)
+{
+    uint8_t pc = cursor.pc;
+
+    switch (fetch(timeline, pc))
+    {
+    case OP_SET:
+        for (uint8_t c = 0; c < 3; c++)
+            cursor.color[c] = fetch(timeline, pc + 1 + c);
+        cursor.pc = pc + 4;
+        return true;
+
+    case OP_RAMP:
+        // A breathing ramp ends where it started
+        if (cursor.ease != EASE_SINE)
+        {
+            for (uint8_t c = 0; c < 3; c++)
+                cursor.color[c] = fetch(timeline, pc + 1 + c);
+        }
+        cursor.at += fetchTime(timeline, pc + 4);
+        cursor.pc = pc + 8;
+        return true;
+
+    case OP_EASE:
+        cursor.ease = fetch(timeline, pc + 1);
+        cursor.pc = pc + 2;
+        return true;
+
+    case OP_WAIT:
+        cursor.at += fetchTime(timeline, pc + 1);
+        cursor.pc = pc + 5;
+        return true;
+
+    case OP_LOOP:
+        if (cursor.loops < fetch(timeline, pc + 1))
+        {
+            cursor.loops++;
+            cursor.pc = fetch(timeline, pc + 2);
+        }
+        else
+        {
+            cursor.loops = 0;
+            cursor.pc = pc + 3;
+        }
+        return true;
+
+    case OP_HUE:
+    {
+        uint8_t to = fetch(timeline, pc + 2), s = fetch(timeline, pc + 3), v = fetch(timeline, pc + 4);
+        for (uint8_t c = 0; c < 3; c++)
+            cursor.color[c] = hsvChannel(to * 6, s, v, c);
+        cursor.at += fetchTime(timeline, pc + 5);
+        cursor.pc = pc + 9;
+        return true;
+    }
+
+    case OP_JUMP:
+        cursor.pc = fetch(timeline, pc + 1);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Read a bytecode byte, past the end reads OP_END
+uint8_t RGBLed::fetch(const Timeline &timeline, uint8_t offset)
+{
+    if (offset >= timeline.length)
+        return OP_END;
+
+    return timeline.progmem ? pgm_read_byte(timeline.code + offset) : timeline.code[offset];
+}
+
+unsigned long RGBLed::fetchTime(const Timeline &timeline, uint8_t offset)
+{
+    return (unsigned long)fetch(timeline, offset) | ((unsigned long)fetch(timeline, offset + 1) << 8) |
+           ((unsigned long)fetch(timeline, offset + 2) << 16) | ((unsigned long)fetch(timeline, offset + 3) << 24);
+}
+
+// Keyframe at t: the cursor's pc is the keyframe, at its start. The first
+// keyframe ramps from the last one.
+void RGBLed::sampleSequence(const Timeline &timeline, Cursor &cursor, unsigned long t, PatternSample &sample)
+{
+    const SequencePattern *p = &timeline.pattern->sequence_pattern;
+    Keyframe to;
+
+    while (cursor.pc < p->count)
+    {
+        readKeyframe(p, cursor.pc, &to);
+        unsigned long length = (unsigned long)to.ramp + to.hold;
+        if (t - cursor.at < length)
+            break;
+        cursor.at += length;
+        cursor.pc++;
+    }
+
+    if (cursor.pc >= p->count)
+    {
+        // Over, the last keyframe stays
+        memset(sample.rgb, 0, 3);
+        if (p->count > 0)
+        {
+            readKeyframe(p, p->count - 1, &to);
+            sample.rgb[0] = to.r;
+            sample.rgb[1] = to.g;
+            sample.rgb[2] = to.b;
         }
+        sample.next = NO_DEADLINE;
+        sample.active = false;
+        return;
     }
+
+    unsigned long elapsed = t - cursor.at;
+    uint8_t rgb_to[3] = {to.r, to.g, to.b};
+
+    if (elapsed < to.ramp)
+    {
+        Keyframe from;
+        readKeyframe(p, cursor.pc == 0 ? p->count - 1 : cursor.pc - 1, &from);
+
+        uint8_t rgb_from[3] = {from.r, from.g, from.b};
+        const RampRate &rate = cursorRate(cursor, to.ramp);
+        uint16_t progress = progress16(elapsed, rate);
+        for (uint8_t c = 0; c < 3; c++)
+            sample.rgb[c] = lerp8(rgb_from[c], rgb_to[c], progress);
+        sample.next = rampDeadline(rgb_from, rgb_to, elapsed, to.ramp, rate);
+        return;
+    }
+
+    memcpy(sample.rgb, rgb_to, 3);
+    sample.next = (unsigned long)to.ramp + to.hold - elapsed;
 }
 
-// Helper function to create static pattern
-Pattern RGBLed::createStaticPattern(uint8_t r, uint8_t g, uint8_t b, unsigned long duration, bool repeat)
-{
-    Pattern pattern;
-    pattern.type = PATTERN_STATIC;
-    pattern.static_pattern.r = r;
-    pattern.static_pattern.g = g;
-    pattern.static_pattern.b = b;
-    pattern.static_pattern.duration = duration;
-    pattern.repeat = repeat;
-    return pattern;
-}
-
-// Helper function to create fade pattern
-Pattern RGBLed::createFadePattern(uint8_t r_start, uint8_t g_start, uint8_t b_start,
-                                   uint8_t r_end, uint8_t g_end, uint8_t b_end,
-                                   unsigned long time_on, unsigned long time_off, bool repeat)
-{
-    Pattern pattern;
-    pattern.type = PATTERN_FADE;
-    pattern.fade_pattern.r_start = r_start;
-    pattern.fade_pattern.g_start = g_start;
-    pattern.fade_pattern.b_start = b_start;
-    pattern.fade_pattern.r_end = r_end;
-    pattern.fade_pattern.g_end = g_end;
-    pattern.fade_pattern.b_end = b_end;
-    pattern.fade_pattern.time_on = time_on;
-    pattern.fade_pattern.time_off = time_off;
-    pattern.repeat = repeat;
-    return pattern;
-}
-
-// Helper function to create blink pattern
-Pattern RGBLed::createBlinkPattern(uint8_t r, uint8_t g, uint8_t b,
-                                    unsigned long time_on, unsigned long time_off,
-                                    uint8_t repeat_count, bool repeat)
-{
-    Pattern pattern;
-    pattern.type = PATTERN_BLINK;
-    pattern.blink_pattern.r = r;
-    pattern.blink_pattern.g = g;
-    pattern.blink_pattern.b = b;
-    pattern.blink_pattern.time_on = time_on;
-    pattern.blink_pattern.time_off = time_off;
-    pattern.blink_pattern.repeat_count = repeat_count;
-    pattern.repeat = repeat;
-    return pattern;
-}
-
-// Helper function to create crossfade pattern
-Pattern RGBLed::createCrossfadePattern(uint8_t r_from, uint8_t g_from, uint8_t b_from,
-                                        uint8_t r_to, uint8_t g_to, uint8_t b_to,
-                                        unsigned long fade_duration, unsigned long hold_duration,
-                                        bool reverse, bool repeat)
-{
-    Pattern pattern;
-    pattern.type = PATTERN_CROSSFADE;
-    pattern.crossfade_pattern.r_from = r_from;
-    pattern.crossfade_pattern.g_from = g_from;
-    pattern.crossfade_pattern.b_from = b_from;
-    pattern.crossfade_pattern.r_to = r_to;
-    pattern.crossfade_pattern.g_to = g_to;
-    pattern.crossfade_pattern.b_to = b_to;
-    pattern.crossfade_pattern.fade_duration = fade_duration;
-    pattern.crossfade_pattern.hold_duration = hold_duration;
-    pattern.crossfade_pattern.reverse = reverse;
-    pattern.repeat = repeat;
-    return pattern;
+// Read one keyframe from RAM or PROGMEM
+void RGBLed::readKeyframe(const SequencePattern *p, uint8_t index, Keyframe *frame)
+{
+    if (p->progmem)
+        memcpy_P(frame, &p->frames[index], sizeof(Keyframe));
+    else
+        *frame = p->frames[index];
+}
+
+
+// Decode a packed pattern, see packPattern()
+Pattern RGBLed::unpackPattern(const PackedPattern &packed)
+{
+    const uint8_t *c = packed.rgb;
+    unsigned long t0 = unpackDuration(packed.time[0]);
+    unsigned long t1 = unpackDuration(packed.time[1]);
+    bool repeat = packed.flags & PACKED_REPEAT;
+
+    switch (packed.flags & PACKED_TYPE_MASK)
+    {
+    case PATTERN_FADE:
+        return createFadePattern(c[0], c[1], c[2], c[3], c[4], c[5], t0, t1, repeat, (Easing)packed.count);
+    case PATTERN_BLINK:
+        return createBlinkPattern(c[0], c[1], c[2], t0, t1, packed.count, repeat);
+    case PATTERN_CROSSFADE:
+        return createCrossfadePattern(c[0], c[1], c[2], c[3], c[4], c[5], t0, t1,
+                                      packed.flags & PACKED_REVERSE, repeat, (Easing)packed.count);
+    case PATTERN_STATIC:
+        return createStaticPattern(c[0], c[1], c[2], t0, repeat);
+    case PATTERN_HUE_CYCLE:
+        return createHueCyclePattern(t0, c[2], c[3], c[0], c[1], repeat);
+    default:
+        // Sequences and programs cannot be packed, play nothing
+        return createSequencePattern(nullptr, 0, false, false);
+    }
 }
\ No newline at end of file
@@ -2,10 +2,11 @@
 #define RGBLed_h
 
 #include "Arduino.h"
+#include "RGBLedStats.h"
 
-// Forward declaration for I2C PWM driver (assuming Adafruit PWM Servo Driver Library)
+// I2C PWM driver (PCA9685), shared between leds
 #ifdef USE_I2C_PWM
-#include <Adafruit_PWMServoDriver.h>
+#include "PCA9685Driver.h"
 #endif
 
 // Pattern types
@@ -14,9 +15,40 @@ enum PatternType
 	PATTERN_STATIC,
 	PATTERN_FADE,
 	PATTERN_BLINK,
-	PATTERN_CROSSFADE
+	PATTERN_CROSSFADE,
+	PATTERN_SEQUENCE,
+	PATTERN_PROGRAM,
+	PATTERN_HUE_CYCLE
 };
 
+// Pattern bytecode, every pattern except sequences runs on it.
+// Times are 4 bytes little endian, in ms.
+enum PatternOpcode
+{
+	OP_END,	 // Stop, completes the pattern
+	OP_SET,	 // r, g, b: set color
+	OP_RAMP, // r, g, b, time: ramp from the current color
+	OP_WAIT, // time: hold the current color
+	OP_LOOP, // n, target: jump to target n times, then continue
+	OP_JUMP, // target: jump
+	OP_HUE,	 // from, to, s, v, time: sweep the hue forward (from == to: one turn)
+	OP_EASE	 // curve: easing of the ramps that follow
+};
+
+// Easing curves for fade and crossfade ramps
+enum Easing
+{
+	EASE_LINEAR,
+	EASE_IN,	 // Slow start (quadratic)
+	EASE_OUT,	 // Slow end (quadratic)
+	EASE_IN_OUT, // Slow start and end (half sine)
+	EASE_SINE	 // Breathing: to the end color and back within the ramp
+};
+
+// Time operand for bytecode tables
+#define PATTERN_TIME(ms) (uint8_t)((unsigned long)(ms) & 0xFF), (uint8_t)(((unsigned long)(ms) >> 8) & 0xFF), \
+						 (uint8_t)(((unsigned long)(ms) >> 16) & 0xFF), (uint8_t)((unsigned long)(ms) >> 24)
+
 // Static color pattern structure
 struct StaticPattern
 {
@@ -31,6 +63,7 @@ struct FadePattern
 	uint8_t r_end, g_end, b_end;
 	unsigned long time_on;	// Fade duration (ms)
 	unsigned long time_off; // Off time after fade (ms)
+	uint8_t easing;			// Easing curve of the fade
 };
 
 // Blink pattern structure
@@ -50,6 +83,39 @@ struct CrossfadePattern
 	unsigned long fade_duration;
 	unsigned long hold_duration;
 	bool reverse; // reverse
+	uint8_t easing; // Easing curve of each fade
+};
+
+// Sequence keyframe: ramp from the previous keyframe, then hold
+struct Keyframe
+{
+	uint8_t r, g, b;
+	uint16_t ramp; // Ramp duration from the previous keyframe (ms)
+	uint16_t hold; // Hold duration (ms)
+};
+
+// Sequence pattern structure, keyframes are read in place (never copied to RAM)
+struct SequencePattern
+{
+	const Keyframe *frames; // Keyframe table, the first ramps from the last
+	uint8_t count;
+	bool progmem; // frames is stored in PROGMEM
+};
+
+// Bytecode program pattern structure, code is read in place
+struct ProgramPattern
+{
+	const uint8_t *code;
+	uint8_t length;
+	bool progmem; // code is stored in PROGMEM
+};
+
+// Hue rotation at fixed saturation and value, hues are 0-255
+struct HueCyclePattern
+{
+	uint8_t hue_from, hue_to; // Forward sweep, equal for a full turn
+	uint8_t saturation, value;
+	unsigned long duration;
 };
 
 // Generic pattern structure
@@ -62,26 +128,127 @@ struct Pattern
 		FadePattern fade_pattern;
 		BlinkPattern blink_pattern;
 		CrossfadePattern crossfade_pattern;
+		SequencePattern sequence_pattern;
+		ProgramPattern program_pattern;
+		HueCyclePattern hue_cycle_pattern;
 	};
 	bool repeat; // Should pattern repeat?
+
+	// constexpr so patterns can be built at compile time and stored in PROGMEM
+	constexpr Pattern() : type(PATTERN_STATIC), static_pattern{0, 0, 0, 0}, repeat(false) {}
+	constexpr Pattern(StaticPattern p, bool repeat) : type(PATTERN_STATIC), static_pattern(p), repeat(repeat) {}
+	constexpr Pattern(FadePattern p, bool repeat) : type(PATTERN_FADE), fade_pattern(p), repeat(repeat) {}
+	constexpr Pattern(BlinkPattern p, bool repeat) : type(PATTERN_BLINK), blink_pattern(p), repeat(repeat) {}
+	constexpr Pattern(CrossfadePattern p, bool repeat) : type(PATTERN_CROSSFADE), crossfade_pattern(p), repeat(repeat) {}
+	constexpr Pattern(SequencePattern p, bool repeat) : type(PATTERN_SEQUENCE), sequence_pattern(p), repeat(repeat) {}
+	constexpr Pattern(ProgramPattern p, bool repeat) : type(PATTERN_PROGRAM), program_pattern(p), repeat(repeat) {}
+	constexpr Pattern(HueCyclePattern p, bool repeat) : type(PATTERN_HUE_CYCLE), hue_cycle_pattern(p), repeat(repeat) {}
+};
+
+// Packed pattern for storage (PROGMEM tables, EEPROM): 12 bytes on every
+// target, against 19 (AVR) to 28 (32-bit) bytes for Pattern.
+// Sequence and program patterns reference their tables and cannot be packed.
+struct PackedPattern
+{
+	uint16_t time[2]; // Encoded durations, see RGBLed::packDuration()
+	uint8_t flags;	  // Type in bits 0-3, repeat bit 4, reverse bit 5
+	uint8_t rgb[6];	  // Color, or start and end colors
+	uint8_t count;	  // Blink repeat count, or easing of fades
+};
+
+static_assert(sizeof(PackedPattern) == 12, "PackedPattern must stay 12 bytes");
+
+// PackedPattern flags
+enum PackedFlags
+{
+	PACKED_TYPE_MASK = 0x0F,
+	PACKED_REPEAT = 0x10,
+	PACKED_REVERSE = 0x20
 };
 
+// What a pattern shows at some time, see RGBLed::evaluate()
+struct PatternSample
+{
+	uint8_t rgb[3];		 // Color before brightness and gamma
+	unsigned long phase; // Position from the start, whole periods removed
+	unsigned long next;	 // ms until the color next changes, NO_DEADLINE when it will not
+	bool active;		 // false once a one-shot pattern is over, rgb is its last color
+};
+
+class TickSource;
+
+// Build flags that change the layout of RGBLed (RGBLED_PATTERN_SLOTS,
+// RGBLED_COMMAND_SLOTS, RGBLED_STATS, USE_I2C_PWM) must be set for the whole
+// build, library included: -DRGBLED_PATTERN_SLOTS=5 or -DRGBLED_STATS in
+// build_flags or compiler.cpp.extra_flags. A #define in the sketch does not
+// reach RGBLed.cpp. The flags are part of the type of the constructor every
+// public one delegates to, so a mismatch fails to link (undefined reference
+// to RGBLed::RGBLed(RGBLedConfig<...>)) instead of running on another layout.
+template <uint8_t Slots, uint8_t Commands, bool Stats, bool I2C>
+struct RGBLedConfig
+{
+};
+#ifdef RGBLED_STATS
+#define RGBLED_CONFIG_STATS true
+#else
+#define RGBLED_CONFIG_STATS false
+#endif
+#ifdef USE_I2C_PWM
+#define RGBLED_CONFIG_I2C true
+#else
+#define RGBLED_CONFIG_I2C false
+#endif
+#define RGBLED_CONFIG RGBLedConfig<RGBLED_PATTERN_SLOTS, RGBLED_COMMAND_SLOTS, RGBLED_CONFIG_STATS, RGBLED_CONFIG_I2C>
+
+// Patterns owned by each led, a build flag (at least 2, see above).
+// Up to RGBLED_PATTERN_SLOTS - 2 patterns can be suspended by pushPattern().
+#ifndef RGBLED_PATTERN_SLOTS
+#define RGBLED_PATTERN_SLOTS 3
+#endif
+static_assert(RGBLED_PATTERN_SLOTS >= 2, "A pattern is copied before the previous one is released");
+
+// Requests the lock-free queue of post*() holds, a build flag (see above).
+// 0, the default, leaves the queue and post*() out: each request holds a
+// Pattern. -DRGBLED_COMMAND_SLOTS=4 for ISRs or another task.
+#ifndef RGBLED_COMMAND_SLOTS
+#define RGBLED_COMMAND_SLOTS 0
+#endif
+static_assert((RGBLED_COMMAND_SLOTS & (RGBLED_COMMAND_SLOTS - 1)) == 0 && RGBLED_COMMAND_SLOTS <= 128,
+			  "RGBLED_COMMAND_SLOTS must be 0 or a power of two up to 128");
+
 // Connection types
 enum ConnectionType
 {
 	DIRECT_CONNECTION,
-	I2C_PWM_CONNECTION
+	I2C_PWM_CONNECTION,
+	NO_CONNECTION // Pattern engine only, e.g. a blend source
+};
+
+// Compositor blend modes, per channel
+enum BlendMode
+{
+	BLEND_MULTIPLY, // a * b / 255, e.g. dim by an envelope
+	BLEND_ADD,		// a + b, saturated
+	BLEND_MAX,		// Brightest of a and b
+	BLEND_ALPHA		// a to b by alpha (0-255)
 };
 
 class RGBLed
 {
 public:
 	// Constructor for direct connection
-	RGBLed(int red, int green, int blue, bool common);
+	RGBLed(int red, int green, int blue, bool common) : RGBLed(RGBLED_CONFIG()) { connectPins(red, green, blue, common); }
+
+	// Constructor without output, runs patterns for blend()
+	RGBLed() : RGBLed(RGBLED_CONFIG()) {}
 
 // Constructor for I2C PWM connection
 #ifdef USE_I2C_PWM
-	RGBLed(Adafruit_PWMServoDriver *pwm, uint8_t red_channel, uint8_t green_channel, uint8_t blue_channel, bool common);
+	RGBLed(PCA9685Driver *pwm, uint8_t red_channel, uint8_t green_channel, uint8_t blue_channel, bool common)
+		: RGBLed(RGBLED_CONFIG())
+	{
+		connectDriver(pwm, red_channel, green_channel, blue_channel, common);
+	}
 #endif
 
 	void off();
@@ -89,6 +256,8 @@ public:
 	void brightness(int rgb[3], int brightness);
 	void brightness(int red, int green, int blue, int brightness);
 	void brightness(int brightness);
+	int brightness() const; // Last brightness set (0-100)
+	void gamma(bool enabled); // Gamma 2.2 correction, off by default (raw values)
 
 	void flash(int rgb[3], int duration);
 	void flash(int rgb[3], int onDuration, int duration);
@@ -97,6 +266,7 @@ public:
 
 	void setColor(int rgb[3]);
 	void setColor(int red, int green, int blue);
+	void setColorHSV(int hue, int saturation, int value); // 0-255 each
 
 	void fadeOut(int rgb[3], int steps, int duration);
 	void fadeOut(int red, int green, int blue, int steps, int duration);
@@ -110,24 +280,211 @@ public:
 	void gradient(int rgbFrom[3], int rgbTo[3], int step);
 	void gradient(int fromRed, int fromGreen, int fromBlue, int toRed, int toGreen, int toBlue, int step);
 
+	// Non-blocking variants, advanced by updatePattern()
+	void flashAsync(int rgb[3], int duration);
+	void flashAsync(int rgb[3], int onDuration, int duration);
+	void flashAsync(int red, int green, int blue, int duration);
+	void flashAsync(int red, int green, int blue, int onDuration, int duration);
+
+	void fadeOutAsync(int rgb[3], int duration);
+	void fadeOutAsync(int red, int green, int blue, int duration);
+
+	void fadeInAsync(int rgb[3], int duration);
+	void fadeInAsync(int red, int green, int blue, int duration);
+
+	void crossFadeAsync(int rgbFrom[3], int rgbTo[3], int duration);
+	void crossFadeAsync(int fromRed, int fromGreen, int fromBlue, int toRed, int toGreen, int toBlue, int duration);
+
 	// New pattern functions
-	void callPattern(Pattern *pattern);
-	void updatePattern(unsigned long now); // Call this in main loop
-	void stopPattern();
+	// Patterns are copied into the led's pool, temporaries are fine. A call
+	// replaces the running pattern and every suspended layer.
+	void callPattern(const Pattern *pattern);
+	void callPattern(const Pattern &pattern);
+	// Phase lock: start as if called at epoch, a millis() value shared by
+	// several leds. Leds running the same pattern then stay in step. An epoch
+	// up to EPOCH_LEAD ahead holds the led dark until it is reached, any other
+	// value is in the past, however old.
+	void callPattern(const Pattern *pattern, unsigned long epoch);
+	void callPattern(const Pattern &pattern, unsigned long epoch);
+	void callPattern_P(const Pattern *pattern); // Pattern stored in PROGMEM
+	void callPattern(const PackedPattern *pattern);
+	void callPattern_P(const PackedPattern *pattern);
+	unsigned long updatePattern(unsigned long now); // Call this in main loop, returns ms until the next change
+	void stopPattern(); // Stops every layer
 	bool isPatternActive();
+	// The pattern running now (the top layer), nullptr when none. The led's
+	// own copy: valid until the next pattern call or update, copy it to keep
+	// it (PatternStore::save(led) does).
+	const Pattern *currentPattern() const;
+	// Move the running pattern to position ms from its start (modulo its period)
+	void seek(unsigned long position);
+
+	// Stateless: what a pattern shows t ms after it starts, computed from its
+	// bytecode op by op, no led involved. updatePattern() runs on the same
+	// code. Programs that loop to a later target (an intro, then a loop) are
+	// folded at their period too, so any t costs at most the intro and one
+	// period.
+	static PatternSample evaluate(const Pattern &pattern, unsigned long t);
+	// Batch: count times of one pattern, e.g. one per led with its own
+	// offset, compiled once. Ascending times walk the program only once.
+	static void evaluate(const Pattern &pattern, const unsigned long *t, PatternSample *samples, uint8_t count);
+
+	// Priority layers: a pattern of equal or higher priority suspends the
+	// running one, which resumes where it left off when the new one completes
+	// or is popped. A lower priority pattern waits below. Returns false when
+	// no slot is left.
+	bool pushPattern(const Pattern *pattern, uint8_t priority);
+	bool pushPattern(const Pattern &pattern, uint8_t priority);
+	void popPattern();
+
+#if RGBLED_COMMAND_SLOTS > 0
+	// Lock-free requests from one other context (ISR or task), applied at the
+	// start of the next update. Return false when the queue is full. The
+	// pattern is copied into the queue.
+	bool postPattern(const Pattern *pattern);
+	bool postStop();
+	bool postBrightness(int brightness);
+#endif
 
-	// Helper functions to create patterns
-	static Pattern createStaticPattern(uint8_t r, uint8_t g, uint8_t b, unsigned long duration, bool repeat = false);
-	static Pattern createFadePattern(uint8_t r_start, uint8_t g_start, uint8_t b_start,
-									 uint8_t r_end, uint8_t g_end, uint8_t b_end,
-									 unsigned long time_on, unsigned long time_off, bool repeat = false);
-	static Pattern createBlinkPattern(uint8_t r, uint8_t g, uint8_t b,
-									  unsigned long time_on, unsigned long time_off,
-									  uint8_t repeat_count = 0, bool repeat = true);
-	static Pattern createCrossfadePattern(uint8_t r_from, uint8_t g_from, uint8_t b_from,
-										  uint8_t r_to, uint8_t g_to, uint8_t b_to,
-										  unsigned long fade_duration, unsigned long hold_duration,
-										  bool reverse = true, bool repeat = true);
+	// Compositor: the color of this led's pattern (a) is blended with the
+	// output of source (b) before brightness and gamma. The source is rendered
+	// by this led's updates, it can blend a source of its own (no cycles).
+	// nullptr detaches it.
+	void blend(RGBLed *source, BlendMode mode, uint8_t alpha = 128);
+
+	// PWM write statistics (per channel)
+	unsigned long writesIssued();
+	unsigned long writesSkipped();
+	void resetWriteCounters();
+
+#ifdef RGBLED_STATS
+	// Engine counters and execute timings (RGBLedStats.h)
+	const RGBLedStats &stats();
+	void resetStats();
+	void printStats(Print &out);
+#endif
+
+	// Helper functions to create patterns (constexpr, usable for PROGMEM patterns)
+	static constexpr Pattern createStaticPattern(uint8_t r, uint8_t g, uint8_t b, unsigned long duration, bool repeat = false)
+	{
+		return Pattern(StaticPattern{r, g, b, duration}, repeat);
+	}
+	static constexpr Pattern createFadePattern(uint8_t r_start, uint8_t g_start, uint8_t b_start,
+											   uint8_t r_end, uint8_t g_end, uint8_t b_end,
+											   unsigned long time_on, unsigned long time_off, bool repeat = false,
+											   Easing easing = EASE_LINEAR)
+	{
+		return Pattern(FadePattern{r_start, g_start, b_start, r_end, g_end, b_end, time_on, time_off, (uint8_t)easing}, repeat);
+	}
+	static constexpr Pattern createBlinkPattern(uint8_t r, uint8_t g, uint8_t b,
+												unsigned long time_on, unsigned long time_off,
+												uint8_t repeat_count = 0, bool repeat = true)
+	{
+		return Pattern(BlinkPattern{r, g, b, time_on, time_off, repeat_count}, repeat);
+	}
+	static constexpr Pattern createCrossfadePattern(uint8_t r_from, uint8_t g_from, uint8_t b_from,
+													uint8_t r_to, uint8_t g_to, uint8_t b_to,
+													unsigned long fade_duration, unsigned long hold_duration,
+													bool reverse = true, bool repeat = true, Easing easing = EASE_LINEAR)
+	{
+		return Pattern(CrossfadePattern{r_from, g_from, b_from, r_to, g_to, b_to, fade_duration, hold_duration, reverse, (uint8_t)easing}, repeat);
+	}
+	static constexpr Pattern createSequencePattern(const Keyframe *frames, uint8_t count,
+												   bool progmem = false, bool repeat = true)
+	{
+		return Pattern(SequencePattern{frames, count, progmem}, repeat);
+	}
+	// Flow control is up to the program (OP_JUMP / OP_END)
+	static constexpr Pattern createProgramPattern(const uint8_t *code, uint8_t length, bool progmem = false)
+	{
+		return Pattern(ProgramPattern{code, length, progmem}, false);
+	}
+
+	// HSV variants, converted to RGB once (fades still interpolate in RGB)
+	static constexpr Pattern createStaticPatternHSV(uint8_t h, uint8_t s, uint8_t v, unsigned long duration, bool repeat = false)
+	{
+		return createStaticPattern(hsvRed(h, s, v), hsvGreen(h, s, v), hsvBlue(h, s, v), duration, repeat);
+	}
+	static constexpr Pattern createFadePatternHSV(uint8_t h_start, uint8_t s_start, uint8_t v_start,
+												  uint8_t h_end, uint8_t s_end, uint8_t v_end,
+												  unsigned long time_on, unsigned long time_off, bool repeat = false,
+												  Easing easing = EASE_LINEAR)
+	{
+		return createFadePattern(hsvRed(h_start, s_start, v_start), hsvGreen(h_start, s_start, v_start), hsvBlue(h_start, s_start, v_start),
+								 hsvRed(h_end, s_end, v_end), hsvGreen(h_end, s_end, v_end), hsvBlue(h_end, s_end, v_end),
+								 time_on, time_off, repeat, easing);
+	}
+	static constexpr Pattern createBlinkPatternHSV(uint8_t h, uint8_t s, uint8_t v,
+												   unsigned long time_on, unsigned long time_off,
+												   uint8_t repeat_count = 0, bool repeat = true)
+	{
+		return createBlinkPattern(hsvRed(h, s, v), hsvGreen(h, s, v), hsvBlue(h, s, v), time_on, time_off, repeat_count, repeat);
+	}
+	static constexpr Pattern createCrossfadePatternHSV(uint8_t h_from, uint8_t s_from, uint8_t v_from,
+													   uint8_t h_to, uint8_t s_to, uint8_t v_to,
+													   unsigned long fade_duration, unsigned long hold_duration,
+													   bool reverse = true, bool repeat = true, Easing easing = EASE_LINEAR)
+	{
+		return createCrossfadePattern(hsvRed(h_from, s_from, v_from), hsvGreen(h_from, s_from, v_from), hsvBlue(h_from, s_from, v_from),
+									  hsvRed(h_to, s_to, v_to), hsvGreen(h_to, s_to, v_to), hsvBlue(h_to, s_to, v_to),
+									  fade_duration, hold_duration, reverse, repeat, easing);
+	}
+	// Sweep the hue through the color wheel (red, yellow, green, ...), a
+	// fade that stays saturated. hue_from == hue_to is a full turn.
+	static constexpr Pattern createHueCyclePattern(unsigned long duration, uint8_t saturation = 255, uint8_t value = 255,
+												   uint8_t hue_from = 0, uint8_t hue_to = 0, bool repeat = true)
+	{
+		return Pattern(HueCyclePattern{hue_from, hue_to, saturation, value, duration}, repeat);
+	}
+
+	// Integer HSV to RGB, hue, saturation and value 0-255
+	static constexpr uint8_t hsvRed(uint8_t h, uint8_t s, uint8_t v) { return hsvChannel(h * 6, s, v, 0); }
+	static constexpr uint8_t hsvGreen(uint8_t h, uint8_t s, uint8_t v) { return hsvChannel(h * 6, s, v, 1); }
+	static constexpr uint8_t hsvBlue(uint8_t h, uint8_t s, uint8_t v) { return hsvChannel(h * 6, s, v, 2); }
+
+	// Fixed-point interpolation used by every executor (no float on FPU-less
+	// targets): progress as Q16 (0-65535), eased, then one channel lerp.
+	// A ramp takes the reciprocal of its duration once (rampRate()), each
+	// tick is then two 16x16 multiplies and a shift instead of a divide.
+	struct RampRate
+	{
+		uint32_t step;	   // ceil(2^32 / duration), after the shift
+		uint16_t duration; // Duration scaled to 16 bits
+		uint8_t shift;	   // Right shift of durations over 16 bits
+	};
+	static RampRate rampRate(unsigned long duration);
+	static uint16_t progress16(unsigned long elapsed, const RampRate &rate);
+	static uint16_t progress16(unsigned long elapsed, unsigned long duration); // One-off, divides
+	static uint16_t ease(uint8_t curve, uint16_t progress);
+	static uint8_t lerp8(uint8_t from, uint8_t to, uint16_t progress);
+
+	// Packed encoding, packPattern() is constexpr for PROGMEM tables
+	static constexpr PackedPattern packPattern(const Pattern &pattern)
+	{
+		return PackedPattern{
+			{packDuration(patternTime(pattern, 0)), packDuration(patternTime(pattern, 1))},
+			(uint8_t)((pattern.type & PACKED_TYPE_MASK) |
+					  (pattern.repeat ? PACKED_REPEAT : 0) |
+					  (pattern.type == PATTERN_CROSSFADE && pattern.crossfade_pattern.reverse ? PACKED_REVERSE : 0)),
+			{patternColor(pattern, 0), patternColor(pattern, 1), patternColor(pattern, 2),
+			 patternColor(pattern, 3), patternColor(pattern, 4), patternColor(pattern, 5)},
+			pattern.type == PATTERN_BLINK ? pattern.blink_pattern.repeat_count
+			: pattern.type == PATTERN_FADE ? pattern.fade_pattern.easing
+			: pattern.type == PATTERN_CROSSFADE ? pattern.crossfade_pattern.easing
+			: (uint8_t)0};
+	}
+	static Pattern unpackPattern(const PackedPattern &packed);
+
+	// PackedPattern durations: exact up to 32767 ms, then 16 ms steps up to
+	// about 524 s. Bytecode and Pattern durations are full unsigned longs.
+	static constexpr uint16_t packDuration(unsigned long ms)
+	{
+		return ms < 0x8000UL ? (uint16_t)ms : (ms / 16 < 0x7FFFUL ? (uint16_t)(0x8000 | ms / 16) : (uint16_t)0xFFFF);
+	}
+	static constexpr unsigned long unpackDuration(uint16_t packed)
+	{
+		return (packed & 0x8000) ? (unsigned long)(packed & 0x7FFF) * 16 : packed;
+	}
 
 	static int RED[3];
 	static int GREEN[3];
@@ -137,10 +494,16 @@ public:
 	static int YELLOW[3];
 	static int WHITE[3];
 
+	static const unsigned long NO_DEADLINE = 0xFFFFFFFFUL; // updatePattern(): nothing to do
+	static const unsigned long EPOCH_LEAD = 3600000UL;	   // callPattern(epoch): latest epoch ahead of millis()
+
 	static bool COMMON_ANODE;
 	static bool COMMON_CATHODE;
 
 private:
+	friend class RGBLedGroup;
+	friend class TickSource;
+
 	// Connection parameters
 	ConnectionType _connection_type;
 
@@ -149,38 +512,229 @@ private:
 
 #ifdef USE_I2C_PWM
 	// I2C PWM connection
-	Adafruit_PWMServoDriver *_pwm_driver;
+	PCA9685Driver *_pwm_driver;
 	uint8_t _red_channel, _green_channel, _blue_channel;
 #endif
 
-	bool _common;
-	int _brightness;
+	uint8_t _invert;		// 0xFF for common anode, XORed into every duty
+	uint16_t _scale;		// Brightness as Q8 (0-256)
+	bool _gamma;
+
+	// Output cache: last duty written per channel
+	uint8_t _duty[3];
+	bool _duty_valid;
+	unsigned long _writes_issued;
+	unsigned long _writes_skipped;
+
+#ifdef RGBLED_STATS
+	RGBLedStats _stats;
+	static void recordTiming(RGBLedTiming &timing, unsigned long start);
+	static void printTiming(Print &out, const char *name, const RGBLedTiming &timing);
+#endif
+
+	// Position in a pattern: the instruction at pc (the keyframe at pc for
+	// sequences) starts at ms from the pattern start
+	struct Cursor
+	{
+		unsigned long at;
+		uint8_t pc;
+		uint8_t loops;	  // OP_LOOP iterations done
+		uint8_t ease;	  // Easing of OP_RAMP, set by OP_EASE
+		uint8_t color[3]; // Last color set, start of OP_RAMP
+		uint8_t rate_pc;  // Instruction (keyframe) rate belongs to, NO_RATE when none
+		RampRate rate;	  // Reciprocal of its duration
+	};
+	static const uint8_t NO_RATE = 0xFF; // Programs are shorter than 255 bytes
+
+	// Everything needed to evaluate a pattern, built once when it starts
+	struct Timeline
+	{
+		const Pattern *pattern;
+		const uint8_t *code; // Compiled pattern or a PATTERN_PROGRAM table
+		uint8_t length;
+		bool progmem;
+		Cursor head;		  // Where the repeating part starts
+		unsigned long period; // Length of the repeating part, 0 when none
+		bool stalls;		  // Loops without time from head on, its color holds
+	};
 
 	// Pattern state variables
 	Pattern *_current_pattern;
-	bool _pattern_active;
-	unsigned long _pattern_start_time;
-	unsigned long _last_update_time;
-	uint8_t _pattern_state; // State machine variable
-	uint8_t _blink_count;	// For blink patterns
-	float _fade_progress;	// For fade patterns (0.0 to 1.0)
-	bool _fade_direction;	// For crossfade reverse
+	volatile bool _pattern_active;
+	unsigned long _pattern_start_time; // Moved forward by whole periods
+	bool _pattern_pending;	// Called ahead of its epoch, dark until _pattern_start_time
+	unsigned long _wake_from;	// The output holds for _wake_for ms from _wake_from,
+	unsigned long _wake_for;	// renders before then return at once (NO_DEADLINE: until re-armed)
+
+	// Bytecode timeline of the current pattern
+	static const uint8_t PROGRAM_SIZE = 34; // Longest compiled pattern (eased crossfade)
+	static const uint16_t MAX_STEPS = 16384; // Instructions walked per evaluation at most
+	uint8_t _program[PROGRAM_SIZE];	// Compiled from the current pattern
+	Timeline _timeline;
+	Cursor _cursor;					// Last instruction evaluated, the walk resumes there
+
+	// Pattern pool: the current pattern lives in one of the slots
+	static const uint8_t NO_SLOT = 0xFF;
+	Pattern _slots[RGBLED_PATTERN_SLOTS];
+	uint8_t _free_slots[RGBLED_PATTERN_SLOTS]; // Stack of free slot indexes
+	uint8_t _free_count;
+	uint8_t _slot;			// Slot of the current pattern, NO_SLOT when none
+	bool _transient;		// Keep the last color when the pattern completes
+	uint8_t _shown[3];		// Last pattern color, restored on resume
+	uint8_t _output[3];		// _shown after the compositor, read by blending leds
+
+	// Suspended patterns, highest priority on top
+	struct Layer
+	{
+		uint8_t slot;
+		uint8_t priority;
+		uint8_t shown[3];
+		bool transient;
+		bool pending; // Started ahead of its epoch, not reached yet
+		bool stalls;  // The timeline found when the pattern started, a
+		Cursor head;  // resume does not walk the pattern again
+		unsigned long period;
+		Cursor cursor; // Where the walk stood when suspended
+		unsigned long start_time;
+		unsigned long suspended_at;
+	};
+	static const uint8_t MAX_LAYERS = RGBLED_PATTERN_SLOTS - 2; // One slot stays free for callPattern()
+	Layer _layers[MAX_LAYERS > 0 ? MAX_LAYERS : 1];
+	uint8_t _layer_count;
+	uint8_t _priority;		// Priority of the current pattern
+
+	// Compositor
+	RGBLed *_blend_source;
+	uint8_t _blend_mode;
+	uint8_t _blend_alpha;
+
+#if RGBLED_COMMAND_SLOTS > 0
+	// Single-producer/single-consumer command ring
+	enum CommandType
+	{
+		COMMAND_PATTERN,
+		COMMAND_STOP,
+		COMMAND_BRIGHTNESS
+	};
+	struct Command
+	{
+		uint8_t type;
+		Pattern pattern; // A copy, the posted one may be gone by the drain
+		int brightness;
+	};
+	Command _commands[RGBLED_COMMAND_SLOTS];
+	volatile uint8_t _command_head; // Requests posted, written by the producer only
+	volatile uint8_t _command_tail; // Requests applied, written by updatePattern only
+#endif
+
+	// Fixed-rate mode: frames are rendered by the tick source
+	TickSource *_tick_source;
+	RGBLed *_tick_next;	   // Next led of the same tick source
+	volatile bool _redraw; // Output changed outside the tick, the next render writes it
 
 	// Private methods
-	void color(int red, int green, int blue);
-	void blink(int red, int green, int blue, int onDuration, int duration);
-	void intensity(int red, int green, int blue, int brightness);
-	void fade(int red, int green, int blue, int steps, int duration, bool out);
-	void fade(int red, int green, int blue, int steps, int duration, int value, bool wait);
+	// Field access for packPattern()
+	static constexpr unsigned long patternTime(const Pattern &p, uint8_t i)
+	{
+		return p.type == PATTERN_STATIC ? (i == 0 ? p.static_pattern.duration : 0)
+			 : p.type == PATTERN_FADE ? (i == 0 ? p.fade_pattern.time_on : p.fade_pattern.time_off)
+			 : p.type == PATTERN_BLINK ? (i == 0 ? p.blink_pattern.time_on : p.blink_pattern.time_off)
+			 : p.type == PATTERN_CROSSFADE ? (i == 0 ? p.crossfade_pattern.fade_duration : p.crossfade_pattern.hold_duration)
+			 : p.type == PATTERN_HUE_CYCLE ? (i == 0 ? p.hue_cycle_pattern.duration : 0)
+			 : 0;
+	}
+	static constexpr uint8_t patternColor(const Pattern &p, uint8_t i)
+	{
+		return p.type == PATTERN_STATIC ? (i == 0 ? p.static_pattern.r : i == 1 ? p.static_pattern.g : i == 2 ? p.static_pattern.b : 0)
+			 : p.type == PATTERN_FADE ? (i == 0 ? p.fade_pattern.r_start : i == 1 ? p.fade_pattern.g_start : i == 2 ? p.fade_pattern.b_start
+										 : i == 3 ? p.fade_pattern.r_end : i == 4 ? p.fade_pattern.g_end : p.fade_pattern.b_end)
+			 : p.type == PATTERN_BLINK ? (i == 0 ? p.blink_pattern.r : i == 1 ? p.blink_pattern.g : i == 2 ? p.blink_pattern.b : 0)
+			 : p.type == PATTERN_CROSSFADE ? (i == 0 ? p.crossfade_pattern.r_from : i == 1 ? p.crossfade_pattern.g_from : i == 2 ? p.crossfade_pattern.b_from
+											  : i == 3 ? p.crossfade_pattern.r_to : i == 4 ? p.crossfade_pattern.g_to : p.crossfade_pattern.b_to)
+			 : p.type == PATTERN_HUE_CYCLE ? (i == 0 ? p.hue_cycle_pattern.hue_from : i == 1 ? p.hue_cycle_pattern.hue_to
+											  : i == 2 ? p.hue_cycle_pattern.saturation : i == 3 ? p.hue_cycle_pattern.value : 0)
+			 : 0;
+	}
+
+	// Integer HSV: the hue is in 1536 steps (6 sectors of 256), each channel
+	// is a trapezoid of the hue, scaled by saturation and value
+	static constexpr uint8_t scale8(uint8_t a, uint8_t b)
+	{
+		return ((uint16_t)a * (b + 1)) >> 8;
+	}
+	static constexpr uint8_t hueWeight(uint8_t sector, uint8_t fraction)
+	{
+		return sector == 0 || sector == 5 ? 255 : sector == 1 ? 255 - fraction : sector == 4 ? fraction : 0;
+	}
+	static constexpr uint8_t hsvChannel(uint16_t hue, uint8_t s, uint8_t v, uint8_t channel)
+	{
+		return scale8(v, 255 - scale8(s, 255 - hueWeight(((hue >> 8) + 6 - 2 * channel) % 6, hue & 0xFF)));
+	}
+
+	static uint16_t brightnessScale(int brightness);
+	static uint8_t output(uint8_t value, uint16_t scale, bool gamma);
+	void intensity(int red, int green, int blue);
+	void show();
+	void writeOutput();
+	static uint8_t blendChannel(uint8_t a, uint8_t b, uint8_t mode, uint8_t alpha);
+	void writeChannel(uint8_t channel, uint8_t duty);
+
+	// Transient pattern handling
+	bool startTransient(const Pattern &pattern);
+	void runTransient();
+	unsigned long completePattern(unsigned long now);
+	void replacePattern(const Pattern *pattern, unsigned long now);
+	bool loadPattern(const Pattern *pattern, unsigned long now);
+	void startSlot(uint8_t slot, unsigned long now);
+	void rewindPattern(unsigned long elapsed, unsigned long now);
+#if RGBLED_COMMAND_SLOTS > 0
+	bool postCommand(uint8_t type, const Pattern *pattern, int brightness);
+	void drainCommands(unsigned long now);
+#endif
+	void releasePattern();
+	void clearPattern();
+	void dropLayers();
+	void suspendLayer(unsigned long now);
+	void insertLayer(uint8_t slot, uint8_t priority, unsigned long now);
+	void resumeLayer(unsigned long now);
+
+	// Pattern pool
+	void initSlots();
+	uint8_t acquireSlot(); // NO_SLOT when the pool is empty
+	void releaseSlot(uint8_t slot);
+	unsigned long renderPattern(unsigned long now);
+
+	void hsvIntensity(uint16_t hue, uint8_t s, uint8_t v);
 
 	// Pattern execution methods
-	void executeStaticPattern(unsigned long now);
-	void executeFadePattern(unsigned long now);
-	void executeBlinkPattern(unsigned long now);
-	void executeCrossfadePattern(unsigned long now);
+	unsigned long executePattern(unsigned long now);
+	static void compilePattern(const Pattern *pattern, uint8_t *code, Timeline &timeline);
+	static void emitPattern(const Pattern *pattern, uint8_t *code, Timeline &timeline);
+	static uint8_t emitTime(uint8_t *code, uint8_t n, unsigned long ms);
+	static void findPeriod(Timeline &timeline);
+	static void startCursor(Cursor &cursor);
+	static PatternSample sampleTimeline(const Timeline &timeline, Cursor &cursor, unsigned long t);
+	static void sampleProgram(const Timeline &timeline, Cursor &cursor, unsigned long t, PatternSample &sample);
+	static void sampleSequence(const Timeline &timeline, Cursor &cursor, unsigned long t, PatternSample &sample);
+	static bool stepProgram(const Timeline &timeline, Cursor &cursor);
+	static const RampRate &cursorRate(Cursor &cursor, unsigned long duration);
+	static unsigned long rampDeadline(const uint8_t from[3], const uint8_t to[3], unsigned long elapsed, unsigned long duration, const RampRate &rate);
+	static unsigned long easedDeadline(uint8_t curve, const uint8_t from[3], const uint8_t to[3], unsigned long elapsed, unsigned long duration, const RampRate &rate);
+	static bool easedMoved(uint8_t curve, const uint8_t from[3], const uint8_t to[3], const uint8_t level[3], unsigned long t, const RampRate &rate);
+	static uint8_t fetch(const Timeline &timeline, uint8_t offset);
+	static unsigned long fetchTime(const Timeline &timeline, uint8_t offset);
+	static void readKeyframe(const SequencePattern *p, uint8_t index, Keyframe *frame);
+
+	// Link-checked constructor (RGBLedConfig) and the connections set after it
+	explicit RGBLed(RGBLED_CONFIG);
+	void connectPins(int red, int green, int blue, bool common);
+#ifdef USE_I2C_PWM
+	void connectDriver(PCA9685Driver *pwm, uint8_t red_channel, uint8_t green_channel, uint8_t blue_channel, bool common);
+#endif
 
 	// Hardware abstraction
 	void writePWM(uint8_t channel_or_pin, uint16_t value, bool is_channel);
+	void flushPWM(bool force);
 	void initHardware();
 };
 
@@ -0,0 +1,221 @@
+#include "Arduino.h"
+#include "RGBLedGroup.h"
+
+#if defined(ESP32)
+#include "soc/soc_caps.h"
+
+// LEDC channels of the chip, high and low speed on the original ESP32
+#if defined(SOC_LEDC_SUPPORT_HS_MODE)
+#define RGBLED_LEDC_CHANNELS (SOC_LEDC_CHANNEL_NUM * 2)
+#else
+#define RGBLED_LEDC_CHANNELS SOC_LEDC_CHANNEL_NUM
+#endif
+#endif
+
+RGBLedGroup::RGBLedGroup(bool common, RGBLedGroupConfig<RGBLED_GROUP_MAX>)
+    : _invert(common == RGBLed::COMMON_ANODE ? 0xFF : 0),
+      _scale(256),
+      _gamma(false),
+      _count(0),
+      _wake_from(0),
+      _wake_for(RGBLed::NO_DEADLINE)
+{
+}
+
+int RGBLedGroup::add(uint8_t red, uint8_t green, uint8_t blue)
+{
+    if (_count >= RGBLED_GROUP_MAX)
+        return -1;
+#if defined(ESP32)
+    // Channels past the last one would not exist, the led would stay dark
+    if ((_count + 1) * 3 > RGBLED_LEDC_CHANNELS)
+        return -1;
+#endif
+
+    uint8_t index = _count++;
+    _pins[index][0] = red;
+    _pins[index][1] = green;
+    _pins[index][2] = blue;
+    _tracks[index].active = false;
+
+    for (uint8_t c = 0; c < 3; c++)
+    {
+#if defined(ESP32)
+        // One LEDC channel per pin, allocated in order
+        ledcSetup(index * 3 + c, 5000, 8);
+        ledcAttachPin(_pins[index][c], index * 3 + c);
+#else
+        pinMode(_pins[index][c], OUTPUT);
+#endif
+        // Force the first write
+        _duty[index][c] = ~_invert;
+    }
+    write(index, 0, 0, 0);
+
+    return index;
+}
+
+uint8_t RGBLedGroup::size()
+{
+    return _count;
+}
+
+void RGBLedGroup::brightness(int brightness)
+{
+    _scale = RGBLed::brightnessScale(brightness);
+}
+
+void RGBLedGroup::gamma(bool enabled)
+{
+    _gamma = enabled;
+}
+
+void RGBLedGroup::setColor(uint8_t index, int red, int green, int blue)
+{
+    if (index >= _count)
+        return;
+
+    write(index, constrain(red, 0, 255), constrain(green, 0, 255), constrain(blue, 0, 255));
+}
+
+void RGBLedGroup::off(uint8_t index)
+{
+    setColor(index, 0, 0, 0);
+}
+
+void RGBLedGroup::callPattern(uint8_t index, const Pattern *pattern)
+{
+    if (index >= _count)
+        return;
+
+    if (pattern == nullptr)
+    {
+        _tracks[index].active = false;
+        return;
+    }
+    _tracks[index].pattern = *pattern;
+    startTrack(index);
+}
+
+// Copy a PROGMEM pattern, ticks then read RAM
+void RGBLedGroup::callPattern_P(uint8_t index, const Pattern *pattern)
+{
+    if (index >= _count)
+        return;
+
+    memcpy_P(&_tracks[index].pattern, pattern, sizeof(Pattern));
+    startTrack(index);
+}
+
+void RGBLedGroup::stopPattern(uint8_t index)
+{
+    if (index >= _count)
+        return;
+
+    _tracks[index].active = false;
+    off(index);
+}
+
+bool RGBLedGroup::isPatternActive(uint8_t index)
+{
+    return index < _count && _tracks[index].active;
+}
+
+// Main update function - call this in loop()
+unsigned long RGBLedGroup::updatePatterns(unsigned long now)
+{
+    // No led changes before the earliest deadline
+    unsigned long waited = now - _wake_from;
+    if (_wake_for == RGBLed::NO_DEADLINE || waited < _wake_for)
+        return _wake_for == RGBLed::NO_DEADLINE ? RGBLed::NO_DEADLINE : _wake_for - waited;
+
+    unsigned long next = RGBLed::NO_DEADLINE;
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        Track &track = _tracks[i];
+        if (!track.active || track.wake_for == RGBLed::NO_DEADLINE)
+            continue;
+
+        unsigned long led_next;
+        unsigned long led_waited = now - track.wake_from;
+        if (led_waited < track.wake_for)
+        {
+            led_next = track.wake_for - led_waited;
+        }
+        else
+        {
+            led_next = executeTrack(i, now);
+            track.wake_from = now;
+            track.wake_for = led_next;
+        }
+
+        if (led_next < next)
+            next = led_next;
+    }
+
+    _wake_from = now;
+    _wake_for = next;
+    return next;
+}
+
+// Compile the pattern of a led and start it now, the next update samples it
+void RGBLedGroup::startTrack(uint8_t index)
+{
+    Track &track = _tracks[index];
+
+    RGBLed::compilePattern(&track.pattern, track.code, track.timeline);
+    RGBLed::startCursor(track.cursor);
+    track.start_time = millis();
+    track.wake_for = 0;
+    track.active = true;
+    _wake_for = 0;
+}
+
+// RGBLed::executePattern() for one led: fold whole periods, sample, write
+unsigned long RGBLedGroup::executeTrack(uint8_t index, unsigned long now)
+{
+    Track &track = _tracks[index];
+    unsigned long t = now - track.start_time;
+    unsigned long period = track.timeline.period;
+
+    if (period > 0 && t >= track.timeline.head.at + period)
+    {
+        unsigned long skip = t - track.timeline.head.at;
+        skip -= skip % period;
+        track.start_time += skip;
+        t -= skip;
+    }
+
+    PatternSample sample = RGBLed::sampleTimeline(track.timeline, track.cursor, t);
+    write(index, sample.rgb[0], sample.rgb[1], sample.rgb[2]);
+
+    // Non-repeating pattern completed
+    if (!sample.active)
+    {
+        track.active = false;
+        off(index);
+        return RGBLed::NO_DEADLINE;
+    }
+    return sample.next;
+}
+
+// Brightness, gamma and common anode inversion, then write changed channels only
+void RGBLedGroup::write(uint8_t index, uint8_t red, uint8_t green, uint8_t blue)
+{
+    uint8_t rgb[3] = {red, green, blue};
+
+    for (uint8_t c = 0; c < 3; c++)
+    {
+        uint8_t duty = RGBLed::output(rgb[c], _scale, _gamma) ^ _invert;
+
+        if (_duty[index][c] == duty)
+            continue;
+
+        _duty[index][c] = duty;
+#if defined(ESP32)
+        ledcWrite(index * 3 + c, duty);
+#else
+        analogWrite(_pins[index][c], duty);
+#endif
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ * RGBLedGroup.h
+ * Drive many RGB leds from one controller
+ *
+ * Every led runs its pattern on the same timeline engine as RGBLed
+ * (compiled pattern, cursor, deadline), so it shows exactly what an RGBLed
+ * shows at the same time, for every pattern type. Each led keeps its own
+ * deadline and the group the earliest one: a tick before it costs one
+ * compare, a tick after it samples only the leds that are due. Per led this
+ * costs about 120 bytes of RAM on AVR (a copy of the pattern, its compiled
+ * code, timeline and cursor, pins and cached duties), against a few hundred
+ * for an RGBLed object and its pattern pool (extras/benchmark prints both
+ * for the host build).
+ *
+ * On ESP32 each led takes three LEDC channels, numbered from 0 in the
+ * order the leds are added. add() fails once the chip has no more.
+ */
+
+#ifndef RGBLED_GROUP_H
+#define RGBLED_GROUP_H
+
+#include "RGBLed.h"
+
+// Maximum number of leds in a group. A build flag: it sizes the arrays
+// below, so the library must be compiled with the same value as the sketch
+// (-DRGBLED_GROUP_MAX=64 in build_flags or compiler.cpp.extra_flags). A
+// #define in the sketch only fails to link, see RGBLedGroupConfig. An AVR
+// has PWM pins for 5 leds at most (Mega), so its default stops there.
+#ifndef RGBLED_GROUP_MAX
+#if defined(__AVR__)
+#define RGBLED_GROUP_MAX 5
+#else
+#define RGBLED_GROUP_MAX 32
+#endif
+#endif
+
+// Carries RGBLED_GROUP_MAX into the mangled name of the real constructor:
+// code built with another value references a constructor that does not
+// exist, instead of running on a different object layout
+template <uint8_t Max>
+struct RGBLedGroupConfig
+{
+};
+
+class RGBLedGroup
+{
+public:
+	RGBLedGroup(bool common) : RGBLedGroup(common, RGBLedGroupConfig<RGBLED_GROUP_MAX>()) {}
+
+	// Add a led, returns its index or -1 when the group is full (or out of
+	// LEDC channels on ESP32)
+	int add(uint8_t red, uint8_t green, uint8_t blue);
+	uint8_t size();
+
+	void brightness(int brightness);
+	void gamma(bool enabled); // Gamma 2.2 correction, off by default
+	void setColor(uint8_t index, int red, int green, int blue);
+	void off(uint8_t index);
+
+	// The pattern is copied, it need not outlive the call
+	void callPattern(uint8_t index, const Pattern *pattern);
+	void callPattern_P(uint8_t index, const Pattern *pattern);
+	void stopPattern(uint8_t index);
+	bool isPatternActive(uint8_t index);
+
+	// Call this in main loop. Returns the time until the next led changes
+	// (ms), RGBLed::NO_DEADLINE when none will
+	unsigned long updatePatterns(unsigned long now);
+
+private:
+	RGBLedGroup(bool common, RGBLedGroupConfig<RGBLED_GROUP_MAX>);
+
+	// Pattern state of one led, the fields RGBLed keeps for its current pattern
+	struct Track
+	{
+		Pattern pattern;
+		uint8_t code[RGBLed::PROGRAM_SIZE];
+		RGBLed::Timeline timeline;
+		RGBLed::Cursor cursor;
+		unsigned long start_time; // Moved forward by whole periods
+		unsigned long wake_from;  // The output holds for wake_for ms from wake_from
+		unsigned long wake_for;
+		bool active;
+	};
+
+	uint8_t _invert;
+	uint16_t _scale;
+	bool _gamma;
+	uint8_t _count;
+
+	// Earliest deadline of the group, updatePatterns() returns before then
+	unsigned long _wake_from;
+	unsigned long _wake_for;
+
+	// Per led data, one entry per index
+	uint8_t _pins[RGBLED_GROUP_MAX][3];
+	uint8_t _duty[RGBLED_GROUP_MAX][3];
+	Track _tracks[RGBLED_GROUP_MAX];
+
+	void startTrack(uint8_t index);
+	unsigned long executeTrack(uint8_t index, unsigned long now);
+	void write(uint8_t index, uint8_t red, uint8_t green, uint8_t blue);
+};
+
+#endif // RGBLED_GROUP_H
@@ -0,0 +1,65 @@
+/*
+ * RGBLedLock.h
+ * Critical section guarding pattern state shared with a TickSource
+ */
+
+#ifndef RGBLED_LOCK_H
+#define RGBLED_LOCK_H
+
+#include "Arduino.h"
+
+// Every variant nests: an unlock restores the state its lock found, so a
+// locked call from a locked section does not open it early.
+// RGBLED_LOCK_IF(condition) only locks when condition holds, its
+// RGBLED_UNLOCK_IF() only unlocks what it locked.
+#if defined(ESP32)
+// A recursive mutex, not a critical section: renders call ledcWrite(),
+// which may block, and the Esp32TickSource runs in a task, not an ISR
+void rgbledLock();
+void rgbledUnlock();
+#define RGBLED_LOCK() rgbledLock()
+#define RGBLED_UNLOCK() rgbledUnlock()
+#define RGBLED_LOCK_IF(condition) bool rgbled_locked = (condition); if (rgbled_locked) rgbledLock()
+#define RGBLED_UNLOCK_IF() if (rgbled_locked) rgbledUnlock()
+#elif defined(__AVR__)
+// Restores the previous interrupt state, safe to use with interrupts disabled
+#define RGBLED_LOCK() uint8_t rgbled_sreg = SREG; cli()
+#define RGBLED_UNLOCK() SREG = rgbled_sreg
+#define RGBLED_LOCK_IF(condition) uint8_t rgbled_sreg = SREG; bool rgbled_locked = (condition); if (rgbled_locked) cli()
+#define RGBLED_UNLOCK_IF() if (rgbled_locked) SREG = rgbled_sreg
+#elif defined(ESP8266)
+// Restores the previous interrupt level
+#define RGBLED_LOCK() uint32_t rgbled_ps = xt_rsil(15)
+#define RGBLED_UNLOCK() xt_wsr_ps(rgbled_ps)
+#define RGBLED_LOCK_IF(condition) uint32_t rgbled_ps = 0; bool rgbled_locked = (condition); if (rgbled_locked) rgbled_ps = xt_rsil(15)
+#define RGBLED_UNLOCK_IF() if (rgbled_locked) xt_wsr_ps(rgbled_ps)
+#elif defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M'
+// Cortex-M: restores PRIMASK
+#define RGBLED_LOCK()          \
+	uint32_t rgbled_primask;   \
+	__asm__ __volatile__("mrs %0, primask\n\tcpsid i" : "=r"(rgbled_primask) :: "memory")
+#define RGBLED_UNLOCK() __asm__ __volatile__("msr primask, %0" :: "r"(rgbled_primask) : "memory")
+#define RGBLED_LOCK_IF(condition)     \
+	uint32_t rgbled_primask = 0;      \
+	bool rgbled_locked = (condition); \
+	if (rgbled_locked)                \
+	__asm__ __volatile__("mrs %0, primask\n\tcpsid i" : "=r"(rgbled_primask) :: "memory")
+#define RGBLED_UNLOCK_IF() if (rgbled_locked) RGBLED_UNLOCK()
+#else
+// The interrupt state cannot be read here: only the outermost unlock
+// enables interrupts. Do not lock from an interrupt handler on these cores.
+extern volatile uint8_t rgbled_lock_depth;
+#define RGBLED_LOCK() do { noInterrupts(); rgbled_lock_depth++; } while (0)
+#define RGBLED_UNLOCK() do { if (--rgbled_lock_depth == 0) interrupts(); } while (0)
+#define RGBLED_LOCK_IF(condition) bool rgbled_locked = (condition); if (rgbled_locked) RGBLED_LOCK()
+#define RGBLED_UNLOCK_IF() if (rgbled_locked) RGBLED_UNLOCK()
+#endif
+
+// Memory barrier for the lock-free command queue
+#if defined(__AVR__)
+#define RGBLED_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define RGBLED_BARRIER() __sync_synchronize()
+#endif
+
+#endif // RGBLED_LOCK_H
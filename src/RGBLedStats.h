@@ -0,0 +1,39 @@
+/*
+ * RGBLedStats.h
+ * Optional runtime counters for the pattern engine, build with RGBLED_STATS
+ * defined to enable them. Disabled, RGBLED_STAT() expands to nothing.
+ */
+
+#ifndef RGBLED_STATS_H
+#define RGBLED_STATS_H
+
+#ifdef RGBLED_STATS
+
+// Time spent in one execute function (us)
+struct RGBLedTiming
+{
+	unsigned long calls;
+	unsigned long total; // Average is total / calls
+	unsigned long max;
+};
+
+struct RGBLedStats
+{
+	unsigned long updates;	   // Renders, from updatePattern() or a TickSource
+	unsigned long writes;	   // Hardware writes (per channel)
+	unsigned long completions; // Patterns run to their end
+	unsigned long repeats;	   // Patterns restarted from the beginning
+	unsigned long skipped;	   // Renders before the next change, executor not run
+	RGBLedTiming program;	   // Program and basic patterns
+	RGBLedTiming sequence;	   // Sequence patterns
+};
+
+#define RGBLED_STAT(statement) statement
+
+#else
+
+#define RGBLED_STAT(statement)
+
+#endif
+
+#endif // RGBLED_STATS_H
@@ -0,0 +1,111 @@
+#include "Arduino.h"
+#include "TickSource.h"
+#include "RGBLedLock.h"
+
+TickSource::TickSource()
+    : _leds(nullptr)
+{
+}
+
+bool TickSource::begin(uint16_t frequency)
+{
+    (void)frequency;
+    return true;
+}
+
+void TickSource::end()
+{
+}
+
+bool TickSource::attach(RGBLed *led)
+{
+    bool attached = false;
+
+    RGBLED_LOCK();
+    if (led->_tick_source == nullptr)
+    {
+        led->_tick_next = _leds;
+        led->_tick_source = this;
+        _leds = led;
+        attached = true;
+    }
+    RGBLED_UNLOCK();
+    return attached;
+}
+
+void TickSource::detach(RGBLed *led)
+{
+    bool detached = false;
+
+    RGBLED_LOCK();
+    for (RGBLed *volatile *link = &_leds; *link != nullptr; link = &(*link)->_tick_next)
+    {
+        if (*link == led)
+        {
+            *link = led->_tick_next;
+            led->_tick_next = nullptr;
+            led->_tick_source = nullptr;
+            detached = true;
+            break;
+        }
+    }
+    RGBLED_UNLOCK();
+
+    // A change the tick had not written yet, the led writes its own from now on
+    if (detached && led->_redraw)
+    {
+        led->_redraw = false;
+        led->writeOutput();
+    }
+}
+
+void TickSource::tick(unsigned long now)
+{
+    // Interrupt handlers already run with interrupts disabled, the ESP32
+    // esp_timer task must take the lock
+#if defined(ESP32)
+    RGBLED_LOCK();
+#endif
+    for (RGBLed *led = _leds; led != nullptr; led = led->_tick_next)
+        led->renderPattern(now);
+#if defined(ESP32)
+    RGBLED_UNLOCK();
+#endif
+}
+
+#if defined(ESP32)
+Esp32TickSource::Esp32TickSource()
+    : _timer(nullptr)
+{
+}
+
+bool Esp32TickSource::begin(uint16_t frequency)
+{
+    if (frequency == 0)
+        return false;
+
+    esp_timer_create_args_t args = {};
+    args.callback = &Esp32TickSource::onTimer;
+    args.arg = this;
+    args.name = "rgbled";
+
+    if (esp_timer_create(&args, &_timer) != ESP_OK)
+        return false;
+    return esp_timer_start_periodic(_timer, 1000000UL / frequency) == ESP_OK;
+}
+
+void Esp32TickSource::end()
+{
+    if (_timer == nullptr)
+        return;
+
+    esp_timer_stop(_timer);
+    esp_timer_delete(_timer);
+    _timer = nullptr;
+}
+
+void Esp32TickSource::onTimer(void *arg)
+{
+    static_cast<Esp32TickSource *>(arg)->tick(millis());
+}
+#endif
@@ -0,0 +1,60 @@
+/*
+ * TickSource.h
+ * Fixed-rate rendering of RGBLed patterns from a timer
+ *
+ * Attached leds are rendered on every tick() instead of from loop(), so
+ * fades stay smooth while the main loop is busy. Pattern changes from the
+ * main context are guarded against the tick, and only the tick writes the
+ * outputs of its leds: a change made elsewhere shows at the next tick.
+ * Only use direct PWM leds: I2C transfers are not allowed from a timer
+ * interrupt.
+ */
+
+#ifndef TICK_SOURCE_H
+#define TICK_SOURCE_H
+
+#include "RGBLed.h"
+
+// Base tick source: call tick() from your own timer interrupt
+class TickSource
+{
+public:
+	TickSource();
+	virtual ~TickSource() {}
+
+	// Start and stop the timer, frequency in Hz
+	virtual bool begin(uint16_t frequency);
+	virtual void end();
+
+	// Render attached leds from now on, updatePattern() then does nothing.
+	// Any number of leds, false when the led already has a tick source.
+	bool attach(RGBLed *led);
+	void detach(RGBLed *led);
+
+	// Render one frame, called from the timer
+	void tick(unsigned long now);
+
+private:
+	RGBLed *volatile _leds; // Attached leds, linked through the led itself
+};
+
+#if defined(ESP32)
+#include "esp_timer.h"
+
+// ESP32 esp_timer, callbacks run in the esp_timer task
+class Esp32TickSource : public TickSource
+{
+public:
+	Esp32TickSource();
+
+	bool begin(uint16_t frequency);
+	void end();
+
+private:
+	esp_timer_handle_t _timer;
+
+	static void onTimer(void *arg);
+};
+#endif
+
+#endif // TICK_SOURCE_H